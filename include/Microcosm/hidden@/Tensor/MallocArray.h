@@ -15,7 +15,7 @@ private:
 
     void swap(SmallStorage &other) { std::swap(mData, other.mData); }
 
-    std::array<Value, SmallSize> mData;
+    alignas(alignof(std::max_align_t)) std::array<Value, SmallSize> mData;
   };
 
   struct LargeStorage {
@@ -143,6 +143,7 @@ public:
         mLarge.clear();
         mData = mSmall.data();
         mSize = newSize;
+        std::fill(mData, mData + mSize, Value());
         return;
       }
     }
@@ -69,9 +69,14 @@ public:
     min(shape, other.shape).forEach([&](auto i) constexpr { access(i) = other.access(i); });
   }
 
-  template <typename Other> requires(concepts::tensor_lambda<Other>) //
+  template <typename Other> requires(concepts::tensor_lambda<Other> && DynamicRank == 0) //
   [[strong_inline]] constexpr Tensor(Other &&other) : Tensor(other.doIt()) {}
 
+  // Note: For dynamic tensors, materialize directly into this type, so that the small storage (if any) is used
+  // without first going through an intermediate heap allocation.
+  template <typename Other> requires(concepts::tensor_lambda<Other> && DynamicRank != 0) //
+  [[strong_inline]] constexpr Tensor(Other &&other) : Tensor(other.template doIt<Tensor>()) {}
+
   template <typename... Values> requires(
     (Rank == 1) && (std::convertible_to<Values, Value> && ...) && sizeof...(Values) > 0 &&
     (DynamicRank == 1 || sizeof...(Values) == Shape::TotalSize))
@@ -143,4 +143,169 @@ private:
   std::vector<double> mCMF;
 };
 
+/// The largest double less than 1, for remapping samples without ever reaching 1.
+inline constexpr double OneMinusEpsilon = 0x1.fffffffffffffp-1;
+
+/// A discrete probability distribution sampled in constant time with the alias method of Walker, as constructed
+/// by Vose. Every bin holds the probability of keeping the bin itself, and otherwise the index of its alias, so that
+/// sampling is one uniform bin choice and one comparison, regardless of the number of weights.
+struct Alias {
+public:
+  Alias() noexcept = default;
+
+  Alias(const std::vector<double> &weights) : mBins(weights.size()) {
+    const int count = size();
+    double total = 0;
+    for (double weight : weights) total += max(weight, 0.0);
+    std::vector<int> small;
+    std::vector<int> large;
+    small.reserve(count);
+    large.reserve(count);
+    for (int i = 0; i < count; i++) {
+      mBins[i].pmf = total > 0 ? max(weights[i], 0.0) / total : 1.0 / count;
+      mBins[i].threshold = mBins[i].pmf * count;
+      mBins[i].alias = i;
+      (mBins[i].threshold < 1 ? small : large).push_back(i);
+    }
+    while (!small.empty() && !large.empty()) {
+      int i = small.back();
+      int j = large.back();
+      small.pop_back();
+      mBins[i].alias = j;
+      mBins[j].threshold -= 1 - mBins[i].threshold;
+      if (mBins[j].threshold < 1) large.pop_back(), small.push_back(j);
+    }
+    // Whatever remains is within round-off of 1.
+    for (int i : small) mBins[i].threshold = 1;
+    for (int i : large) mBins[i].threshold = 1;
+  }
+
+  [[nodiscard]] int size() const noexcept { return int(mBins.size()); }
+
+  [[nodiscard]] bool isInRange(int i) const noexcept { return 0 <= i && i < size(); }
+
+  /// The Probability Mass Function (PMF). This is the discrete probability of sampling the given integer.
+  [[nodiscard]] double distributionPMF(int i) const noexcept { return isInRange(i) ? mBins[i].pmf : 0; }
+
+  [[nodiscard]] int distributionSample(double sampleU) const noexcept {
+    double sampleRemapped = 0;
+    return distributionSample(sampleU, sampleRemapped);
+  }
+
+  /// \overload
+  ///
+  /// This also remaps the sample to a fresh uniform sample, which may be reused for subsequent sampling decisions.
+  [[nodiscard]] int distributionSample(double sampleU, double &sampleRemapped) const noexcept {
+    if (mBins.empty()) return 0;
+    double param = saturate(sampleU) * size();
+    int i = min(int(param), size() - 1);
+    double fract = min(param - i, OneMinusEpsilon);
+    if (fract < mBins[i].threshold) {
+      sampleRemapped = min(fract / mBins[i].threshold, OneMinusEpsilon);
+      return i;
+    } else {
+      sampleRemapped = min((fract - mBins[i].threshold) / (1 - mBins[i].threshold), OneMinusEpsilon);
+      return mBins[i].alias;
+    }
+  }
+
+  [[nodiscard]] int operator()(auto &gen) const noexcept { return distributionSample(randomize<double>(gen)); }
+
+  void onSerialize(auto &serializer) { serializer <=> mBins; }
+
+private:
+  struct Bin {
+    /// The probability of the bin.
+    double pmf = 0;
+
+    /// The probability of keeping the bin rather than taking its alias, given that the bin is chosen uniformly.
+    double threshold = 0;
+
+    /// The alias.
+    int alias = 0;
+
+    void onSerialize(auto &serializer) { serializer <=> pmf <=> threshold <=> alias; }
+  };
+
+  std::vector<Bin> mBins;
+};
+
+/// A piecewise constant probability distribution over a range, with one bin of equal width per weight.
+///
+/// \note
+/// The sampling routine is monotonic, and the Cumulative Distribution Function (CDF) is its exact inverse, which
+/// makes the distribution suitable for mapping points back to primary samples, e.g., for Metropolis mutations.
+///
+struct PiecewiseConstant {
+public:
+  PiecewiseConstant() noexcept = default;
+
+  PiecewiseConstant(const std::vector<double> &weights, double valueA = 0, double valueB = 1) : mCDF(weights.size() + 1), mValueA(valueA), mValueB(valueB) {
+    if (mValueB < mValueA) std::swap(mValueA, mValueB);
+    const int count = size();
+    mCDF[0] = 0;
+    for (int i = 0; i < count; i++) mCDF[i + 1] = mCDF[i] + max(weights[i], 0.0) / count;
+    mIntegral = mCDF[count] * (mValueB - mValueA);
+    if (mCDF[count] > 0) {
+      for (int i = 1; i <= count; i++) mCDF[i] /= mCDF[count];
+    } else {
+      for (int i = 1; i <= count; i++) mCDF[i] = double(i) / count;
+    }
+    if (count > 0) mCDF[count] = 1;
+  }
+
+  [[nodiscard]] int size() const noexcept { return max(int(mCDF.size()) - 1, 0); }
+
+  /// The integral of the weights over the range, before normalization.
+  [[nodiscard]] double integral() const noexcept { return mIntegral; }
+
+  /// The probability of the given bin.
+  [[nodiscard]] double binPMF(int i) const noexcept { return 0 <= i && i < size() ? mCDF[i + 1] - mCDF[i] : 0; }
+
+  [[nodiscard]] double distributionPDF(double value) const noexcept {
+    if (!(mValueA <= value && value < mValueB) || size() == 0) return 0;
+    int i = min(int(unlerp(value, mValueA, mValueB) * size()), size() - 1);
+    return binPMF(i) * size() / (mValueB - mValueA);
+  }
+
+  [[nodiscard]] double distributionCDF(double value) const noexcept {
+    if (size() == 0) return 0;
+    double param = saturate(unlerp(value, mValueA, mValueB)) * size();
+    int i = min(int(param), size() - 1);
+    return lerp(param - i, mCDF[i], mCDF[i + 1]);
+  }
+
+  [[nodiscard]] double distributionSample(double sampleU) const noexcept {
+    int i = 0;
+    return distributionSample(sampleU, i);
+  }
+
+  /// \overload
+  ///
+  /// This also returns the index of the sampled bin.
+  [[nodiscard]] double distributionSample(double sampleU, int &i) const noexcept {
+    if (size() == 0) return mValueA;
+    sampleU = saturate(sampleU);
+    i = int(std::distance(mCDF.begin(), std::upper_bound(mCDF.begin(), mCDF.end(), sampleU))) - 1;
+    i = std::clamp(i, 0, size() - 1);
+    while (i > 0 && !(mCDF[i + 1] > mCDF[i])) i--; // Never land in an empty bin.
+    double fract = saturate(finiteOrZero((sampleU - mCDF[i]) / (mCDF[i + 1] - mCDF[i])));
+    return lerp((i + fract) / size(), mValueA, mValueB);
+  }
+
+  [[nodiscard]] double operator()(auto &gen) const noexcept { return distributionSample(randomize<double>(gen)); }
+
+  void onSerialize(auto &serializer) { serializer <=> mCDF <=> mValueA <=> mValueB <=> mIntegral; }
+
+private:
+  /// The cumulative probabilities at the bin boundaries.
+  std::vector<double> mCDF;
+
+  double mValueA = 0;
+
+  double mValueB = 1;
+
+  double mIntegral = 0;
+};
+
 } // namespace mi::distributions
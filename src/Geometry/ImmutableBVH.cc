@@ -1,14 +1,23 @@
 #include "Microcosm/Geometry/ImmutableBVH"
+#include <bit>
+#include <omp.h>
 
 namespace mi::geometry {
 
 /// An immutable bounding volume hierarchy builder.
+///
+/// If parallel, the build runs as a tree of OpenMP tasks. Near the root, where there are few but large ranges, the
+/// bounds and the SAH bins of each range are computed in parallel over chunks of items. Below that, once a range
+/// is small enough, each subtree is built serially by whichever thread picks up its task. Every thread allocates
+/// nodes from its own arena, and the first item index of each leaf is the offset of its range in the items array,
+/// so the result is identical to the serial build regardless of scheduling.
 template <size_t N> class ImmutableBVHBuilder {
 public:
   using BVH = ImmutableBVH<N>;
   using Box = typename BVH::Box;
   using Item = typename BVH::Item;
   using Items = typename BVH::Items;
+  using Point = typename BVH::Point;
 
   struct Node {
     Box box{};            ///< Box.
@@ -17,45 +26,385 @@ public:
     ssize_t splitAxis{0}; ///< If branch, split axis.
     ssize_t firstItem{0}; ///< If leaf, first item index.
     ssize_t itemCount{0}; ///< If leaf, item count.
+    float cost{0};        ///< The SAH cost, only used by the treelet optimization.
   };
 
+  /// The SAH split candidate, for comparing object splits against spatial splits.
+  struct SplitCandidate {
+    float cost{constants::Inff}; ///< The cost, as the sum of area times count on either side.
+    Box boxL{};                  ///< The box on the left side.
+    Box boxR{};                  ///< The box on the right side.
+    ssize_t axis{0};             ///< The axis, for spatial splits.
+    float position{0};           ///< The plane position, for spatial splits.
+  };
+
+  /// The maximum number of bins.
+  static constexpr ssize_t MaxBins = 64;
+
+  /// The minimum number of items in a range to bother spawning a task.
+  static constexpr ssize_t MinItemsForTask = 4096;
+
+  /// The minimum number of items in a range to bother computing the bounds and bins in parallel.
+  static constexpr ssize_t MinItemsForParallelBinning = 65536;
+
+  /// The number of items per chunk when computing the bounds and bins in parallel.
+  static constexpr ssize_t ItemsPerChunk = 16384;
+
   Node *root{};
   ssize_t leafLimit{4};
-  ssize_t nodeCount{0};
-  MemoryArena<> nodeArena{};
+  ssize_t numBins{8};
+  bool parallel{true};
+  std::atomic<ssize_t> nodeCount{0};
+  std::vector<MemoryArena<>> nodeArenas{};
+  Item *firstItemPointer{};
+  std::function<Box(uint32_t, const Box &)> clipper{};
+  float spatialSplitAlpha{1e-5f};
+  ssize_t spatialSplitBudget{0};
+  float rootArea{0};
 
 public:
   /// Build.
   void build(Items &items) {
-    ssize_t firstItem{0};
-    root = buildRange(firstItem, IteratorRange(items.data(), items.size()));
-    assert(firstItem == ssize_t(items.size()));
+    firstItemPointer = items.data();
+    numBins = std::clamp<ssize_t>(numBins, 2, MaxBins);
+    if (parallel && ssize_t(items.size()) >= MinItemsForTask && omp_get_max_threads() > 1) {
+      nodeArenas = std::vector<MemoryArena<>>(omp_get_max_threads());
+#pragma omp parallel
+#pragma omp single
+      root = buildRange(IteratorRange(items.data(), items.size()));
+    } else {
+      parallel = false;
+      nodeArenas = std::vector<MemoryArena<>>(1);
+      root = buildRange(IteratorRange(items.data(), items.size()));
+    }
+  }
+
+  /// Build with spatial splits. This is always serial, because the items are not a fixed range anymore: spatial
+  /// splits duplicate the items straddling the split plane, so every subtree must build into its own item list, and
+  /// the leaves append their items to the output in order.
+  void buildSpatial(Items &items) {
+    parallel = false;
+    numBins = std::clamp<ssize_t>(numBins, 2, MaxBins);
+    nodeArenas = std::vector<MemoryArena<>>(1);
+    rootArea = computeBounds(IteratorRange(items.data(), items.size())).first.hyperArea();
+    Items output;
+    output.reserve(items.size() + spatialSplitBudget);
+    root = buildRangeSpatial(std::move(items), output);
+    items = std::move(output);
   }
 
   /// Build range recursively.
-  [[nodiscard]] Node *buildRange(ssize_t &firstItem, IteratorRange<Item *> items) {
-    Node *node{new (nodeArena) Node()};
+  [[nodiscard]] Node *buildRange(IteratorRange<Item *> items) {
+    Node *node{new (nodeArenas[parallel ? omp_get_thread_num() : 0]) Node()};
     nodeCount++;
-    Box box, boxCenter;
-    for (const Item &item : items) box |= item.box, boxCenter |= item.boxCenter;
+    auto [box, boxCenter] = computeBounds(items);
     ssize_t splitAxis{static_cast<ssize_t>(argmax(boxCenter.extent()))};
     ssize_t itemCount{static_cast<ssize_t>(items.size())};
     if (itemCount <= leafLimit) { // Leaf?
-      *node = {box, nullptr, nullptr, 0, firstItem, itemCount};
-      firstItem += itemCount;
+      *node = {box, nullptr, nullptr, 0, items.begin() - firstItemPointer, itemCount};
     } else {
       Item *split{findSplitSAH(boxCenter, splitAxis, items)};
-      Node *child0{buildRange(firstItem, {items.begin(), split})};
-      Node *child1{buildRange(firstItem, {split, items.end()})};
+      Node *child0{nullptr};
+      Node *child1{nullptr};
+      if (parallel && itemCount >= MinItemsForTask) {
+#pragma omp task default(shared)
+        child0 = buildRange({items.begin(), split});
+        child1 = buildRange({split, items.end()});
+#pragma omp taskwait
+      } else {
+        child0 = buildRange({items.begin(), split});
+        child1 = buildRange({split, items.end()});
+      }
       *node = {box, child0, child1, splitAxis, 0, 0};
     }
     return node;
   }
 
+  /// Build range recursively with spatial splits.
+  [[nodiscard]] Node *buildRangeSpatial(Items items, Items &output) {
+    Node *node{new (nodeArenas[0]) Node()};
+    nodeCount++;
+    IteratorRange<Item *> range(items.data(), items.size());
+    auto [box, boxCenter] = computeBounds(range);
+    ssize_t splitAxis{static_cast<ssize_t>(argmax(boxCenter.extent()))};
+    ssize_t itemCount{static_cast<ssize_t>(items.size())};
+    if (itemCount <= leafLimit) { // Leaf?
+      *node = {box, nullptr, nullptr, 0, ssize_t(output.size()), itemCount};
+      output.insert(output.end(), items.begin(), items.end());
+      return node;
+    }
+    SplitCandidate objectSplit;
+    Item *split{findSplitSAH(boxCenter, splitAxis, range, &objectSplit)};
+    Items itemsL;
+    Items itemsR;
+    bool isSpatial{false};
+
+    // Only consider a spatial split if the children of the object split overlap significantly relative to the
+    // root, as in the original SBVH paper. Otherwise a spatial split is very unlikely to win, and is expensive
+    // to evaluate.
+    Box overlap{objectSplit.boxL & objectSplit.boxR};
+    if (spatialSplitBudget > 0 && (objectSplit.cost == constants::Inff || (overlap && overlap.hyperArea() > spatialSplitAlpha * rootArea))) {
+      if (SplitCandidate spatialSplit{findSpatialSplit(box, range)}; spatialSplit.cost < objectSplit.cost) {
+        for (const Item &item : items) {
+          if (item.box.upper()[spatialSplit.axis] <= spatialSplit.position) {
+            itemsL.push_back(item);
+          } else if (item.box.lower()[spatialSplit.axis] >= spatialSplit.position) {
+            itemsR.push_back(item);
+          } else {
+            Point upperL{item.box.upper()};
+            Point lowerR{item.box.lower()};
+            upperL[spatialSplit.axis] = spatialSplit.position;
+            lowerR[spatialSplit.axis] = spatialSplit.position;
+            Box slabL{item.box.lower(), upperL};
+            Box slabR{lowerR, item.box.upper()};
+            if (Box clipL{clip(item, slabL)}; clipL) itemsL.push_back({item.index, clipL, clipL.center()});
+            if (Box clipR{clip(item, slabR)}; clipR) itemsR.push_back({item.index, clipR, clipR.center()});
+          }
+        }
+        // Reject the split if it duplicates more items than the remaining budget allows, rather than overshooting.
+        ssize_t numDuplicates{ssize_t(itemsL.size() + itemsR.size()) - itemCount};
+        isSpatial = !itemsL.empty() && !itemsR.empty() && ssize_t(itemsL.size()) < itemCount && ssize_t(itemsR.size()) < itemCount && numDuplicates <= spatialSplitBudget;
+        if (isSpatial) {
+          spatialSplitBudget -= numDuplicates;
+          splitAxis = spatialSplit.axis;
+        } else {
+          itemsL.clear();
+          itemsR.clear();
+        }
+      }
+    }
+    if (!isSpatial) {
+      itemsL.assign(range.begin(), split);
+      itemsR.assign(split, range.end());
+    }
+    items = Items();
+    Node *child0{buildRangeSpatial(std::move(itemsL), output)};
+    Node *child1{buildRangeSpatial(std::move(itemsR), output)};
+    *node = {box, child0, child1, splitAxis, 0, 0};
+    return node;
+  }
+
+  /// Clip the given item to the given box, which is assumed to be inside the item box already.
+  [[nodiscard]] Box clip(const Item &item, const Box &clipBox) const {
+    return clipper ? std::invoke(clipper, item.index, clipBox) & clipBox : clipBox;
+  }
+
+  /// Find the best spatial split over all axes.
+  [[nodiscard]] SplitCandidate findSpatialSplit(const Box &box, IteratorRange<Item *> items) const {
+    const ssize_t Nbins = numBins;
+    SplitCandidate best;
+    for (ssize_t axis = 0; axis < ssize_t(N); axis++) {
+      float lower{box.lower()[axis]};
+      float upper{box.upper()[axis]};
+      if (!(lower < upper)) continue;
+      auto binIndex = [&](float coord) { return std::clamp<ssize_t>(Nbins * unlerp(coord, lower, upper), 0, Nbins - 1); };
+      auto binPosition = [&](ssize_t index) { return lerp(float(index) / float(Nbins), lower, upper); };
+
+      // Initialize bins. Every item is clipped to every bin it overlaps, and is counted as entering in its first
+      // bin and exiting in its last bin.
+      std::array<Box, MaxBins> bins{};
+      std::array<ssize_t, MaxBins> entries{};
+      std::array<ssize_t, MaxBins> exits{};
+      for (const Item &item : items) {
+        ssize_t indexL{binIndex(item.box.lower()[axis])};
+        ssize_t indexR{binIndex(item.box.upper()[axis])};
+        if (indexL == indexR) {
+          bins[indexL] |= item.box;
+        } else {
+          for (ssize_t index = indexL; index <= indexR; index++) {
+            Point slabLower{item.box.lower()};
+            Point slabUpper{item.box.upper()};
+            slabLower[axis] = std::max(slabLower[axis], binPosition(index));
+            slabUpper[axis] = std::min(slabUpper[axis], binPosition(index + 1));
+            if (Box clipped{clip(item, Box(slabLower, slabUpper))}; clipped) bins[index] |= clipped;
+          }
+        }
+        entries[indexL]++;
+        exits[indexR]++;
+      }
+
+      // Sweep and compute costs.
+      std::array<Box, MaxBins> sweepBoxR{};
+      std::array<ssize_t, MaxBins> sweepCountR{};
+      sweepBoxR[Nbins - 1] = bins[Nbins - 1];
+      sweepCountR[Nbins - 1] = exits[Nbins - 1];
+      for (ssize_t index = Nbins - 2; index > 0; index--) {
+        sweepBoxR[index] = sweepBoxR[index + 1] | bins[index];
+        sweepCountR[index] = sweepCountR[index + 1] + exits[index];
+      }
+      Box sweepBoxL{};
+      ssize_t sweepCountL{0};
+      for (ssize_t index = 1; index < Nbins; index++) {
+        sweepBoxL |= bins[index - 1];
+        sweepCountL += entries[index - 1];
+        if (sweepCountL == 0 || sweepCountR[index] == 0) continue;
+        if (float cost{sweepBoxL.hyperArea() * sweepCountL + sweepBoxR[index].hyperArea() * sweepCountR[index]}; best.cost > cost) {
+          best.cost = cost;
+          best.boxL = sweepBoxL;
+          best.boxR = sweepBoxR[index];
+          best.axis = axis;
+          best.position = binPosition(index);
+        }
+      }
+    }
+    return best;
+  }
+
+  /// The maximum number of leaves in a treelet.
+  static constexpr ssize_t MaxTreeletLeaves = 7;
+
+  /// The maximum depth to spawn tasks for the treelet optimization.
+  static constexpr ssize_t MaxDepthForTask = 12;
+
+  /// Optimize the tree by restructuring treelets, as in Karras and Aila, "Fast parallel construction of
+  /// high-quality bounding volume hierarchies". This visits the nodes bottom-up, and at every branch node grows a
+  /// treelet of up to the given number of leaves by repeatedly opening up the treelet leaf with the largest
+  /// area, then finds the topology over the treelet leaves that minimizes the SAH cost by dynamic programming.
+  void optimizeTreelets(ssize_t treeletLeaves) {
+    treeletLeaves = std::clamp<ssize_t>(treeletLeaves, 3, MaxTreeletLeaves);
+    if (parallel && nodeCount >= MinItemsForTask && omp_get_max_threads() > 1) {
+#pragma omp parallel
+#pragma omp single
+      optimizeTreelets(root, treeletLeaves, 0);
+    } else {
+      parallel = false;
+      optimizeTreelets(root, treeletLeaves, 0);
+    }
+  }
+
+  void optimizeTreelets(Node *node, ssize_t treeletLeaves, ssize_t depth) {
+    constexpr float TraversalCost = 1.0f;
+    constexpr float IntersectCost = 1.0f;
+    if (node->itemCount > 0) {
+      node->cost = IntersectCost * node->box.hyperArea() * node->itemCount;
+      return;
+    }
+    if (parallel && depth < MaxDepthForTask) {
+#pragma omp task default(shared)
+      optimizeTreelets(node->left, treeletLeaves, depth + 1);
+      optimizeTreelets(node->right, treeletLeaves, depth + 1);
+#pragma omp taskwait
+    } else {
+      optimizeTreelets(node->left, treeletLeaves, depth + 1);
+      optimizeTreelets(node->right, treeletLeaves, depth + 1);
+    }
+
+    // Form the treelet. The internal nodes are remembered so that they can be reused for the new topology.
+    Node *leaves[MaxTreeletLeaves]{node->left, node->right};
+    Node *internals[MaxTreeletLeaves]{node};
+    ssize_t numLeaves{2};
+    ssize_t numInternals{1};
+    while (numLeaves < treeletLeaves) {
+      ssize_t best{-1};
+      float bestArea{-1};
+      for (ssize_t k = 0; k < numLeaves; k++)
+        if (leaves[k]->itemCount == 0 && leaves[k]->box.hyperArea() > bestArea) best = k, bestArea = leaves[k]->box.hyperArea();
+      if (best < 0) break;
+      Node *open{leaves[best]};
+      internals[numInternals++] = open;
+      leaves[best] = open->left;
+      leaves[numLeaves++] = open->right;
+    }
+
+    // Find the optimal topology with dynamic programming over subsets of treelet leaves.
+    const uint32_t numSubsets{uint32_t(1) << numLeaves};
+    std::array<float, 1 << MaxTreeletLeaves> subsetArea{};
+    std::array<float, 1 << MaxTreeletLeaves> subsetCost{};
+    std::array<uint32_t, 1 << MaxTreeletLeaves> subsetSplit{};
+    for (uint32_t subset = 1; subset < numSubsets; subset++) {
+      Box box;
+      for (ssize_t k = 0; k < numLeaves; k++)
+        if (subset & (uint32_t(1) << k)) box |= leaves[k]->box;
+      subsetArea[subset] = box.hyperArea();
+    }
+    for (ssize_t k = 0; k < numLeaves; k++) subsetCost[uint32_t(1) << k] = leaves[k]->cost;
+    for (uint32_t subset = 1; subset < numSubsets; subset++) {
+      if (std::has_single_bit(subset)) continue;
+      float bestCost{constants::Inff};
+      uint32_t bestSplit{0};
+      // Enumerate the proper subsets containing the lowest bit, so that each partition is only visited once.
+      uint32_t lowest{subset & (~subset + 1)};
+      for (uint32_t part = (subset - 1) & subset; part != 0; part = (part - 1) & subset) {
+        if (!(part & lowest)) continue;
+        if (float cost{subsetCost[part] + subsetCost[subset & ~part]}; bestCost > cost) bestCost = cost, bestSplit = part;
+      }
+      subsetCost[subset] = TraversalCost * subsetArea[subset] + bestCost;
+      subsetSplit[subset] = bestSplit;
+    }
+
+    // Rebuild the treelet with the optimal topology, if it is actually better.
+    const uint32_t fullSubset{numSubsets - 1};
+    if (subsetCost[fullSubset] < currentCost(node, leaves, numLeaves) * 0.9999f) {
+      ssize_t internalIndex{0};
+      auto rebuild = [&](auto &&self, uint32_t subset) -> Node * {
+        if (std::has_single_bit(subset)) return leaves[std::countr_zero(subset)];
+        Node *each{internals[internalIndex++]};
+        Node *child0{self(self, subsetSplit[subset])};
+        Node *child1{self(self, subset & ~subsetSplit[subset])};
+        each->box = child0->box | child1->box;
+        each->left = child0;
+        each->right = child1;
+        each->splitAxis = argmax(abs(child1->box.center() - child0->box.center()));
+        each->firstItem = 0;
+        each->itemCount = 0;
+        each->cost = subsetCost[subset];
+        return each;
+      };
+      rebuild(rebuild, fullSubset);
+    } else {
+      node->cost = TraversalCost * node->box.hyperArea() + node->left->cost + node->right->cost;
+    }
+  }
+
+  /// The cost of the current treelet topology, recomputing the cost of internal nodes on the way down.
+  [[nodiscard]] static float currentCost(Node *node, Node **leaves, ssize_t numLeaves) {
+    for (ssize_t k = 0; k < numLeaves; k++)
+      if (leaves[k] == node) return node->cost;
+    return node->box.hyperArea() + currentCost(node->left, leaves, numLeaves) + currentCost(node->right, leaves, numLeaves);
+  }
+
+  /// Run the given function on each chunk of the given items, in parallel if the range is large enough.
+  void forEachChunk(IteratorRange<Item *> items, auto &&func) const {
+    ssize_t itemCount{static_cast<ssize_t>(items.size())};
+    if (parallel && itemCount >= MinItemsForParallelBinning) {
+      ssize_t numChunks{(itemCount + ItemsPerChunk - 1) / ItemsPerChunk};
+#pragma omp taskloop default(shared) grainsize(1)
+      for (ssize_t chunkIndex = 0; chunkIndex < numChunks; chunkIndex++) {
+        Item *chunkBegin{items.begin() + chunkIndex * ItemsPerChunk};
+        Item *chunkEnd{items.begin() + std::min((chunkIndex + 1) * ItemsPerChunk, itemCount)};
+        func(chunkIndex, IteratorRange<Item *>(chunkBegin, chunkEnd));
+      }
+    } else {
+      func(ssize_t(0), items);
+    }
+  }
+
+  /// The number of chunks that forEachChunk() uses for the given items.
+  [[nodiscard]] ssize_t numChunks(IteratorRange<Item *> items) const noexcept {
+    ssize_t itemCount{static_cast<ssize_t>(items.size())};
+    return parallel && itemCount >= MinItemsForParallelBinning ? (itemCount + ItemsPerChunk - 1) / ItemsPerChunk : 1;
+  }
+
+  /// Compute the box and the box of the box centers.
+  [[nodiscard]] std::pair<Box, Box> computeBounds(IteratorRange<Item *> items) const {
+    std::vector<std::pair<Box, Box>> chunkBounds(numChunks(items));
+    forEachChunk(items, [&](ssize_t chunkIndex, IteratorRange<Item *> chunk) {
+      auto &[box, boxCenter] = chunkBounds[chunkIndex];
+      for (const Item &item : chunk) box |= item.box, boxCenter |= item.boxCenter;
+    });
+    std::pair<Box, Box> bounds{chunkBounds[0]};
+    for (size_t chunkIndex = 1; chunkIndex < chunkBounds.size(); chunkIndex++) {
+      bounds.first |= chunkBounds[chunkIndex].first;
+      bounds.second |= chunkBounds[chunkIndex].second;
+    }
+    return bounds;
+  }
+
   /// Find split using surface area heuristic.
-  [[nodiscard]] static Item *findSplitSAH(const Box &boxCenter, ssize_t splitAxis, IteratorRange<Item *> items) {
-    constexpr ssize_t Nbins = 8;
+  [[nodiscard]] Item *findSplitSAH(const Box &boxCenter, ssize_t splitAxis, IteratorRange<Item *> items, SplitCandidate *candidate = nullptr) const {
+    const ssize_t Nbins = numBins;
     using Bin = std::pair<Box, ssize_t>;
+    using Bins = std::array<Bin, MaxBins>;
     if (boxCenter.lower()[splitAxis] == boxCenter.upper()[splitAxis]) return findSplitEqualCounts(splitAxis, items);
 
     auto itemIndex = [&](const Item &item) {
@@ -67,27 +416,33 @@ public:
     };
 
     // Initialize bins.
-    std::array<Bin, Nbins> bins{};
-    for (const Item &item : items) {
-      ssize_t index{itemIndex(item)};
-      bins[index].first |= item.box;
-      bins[index].second++;
+    std::vector<Bins> chunkBins(numChunks(items));
+    forEachChunk(items, [&](ssize_t chunkIndex, IteratorRange<Item *> chunk) {
+      Bins &bins{chunkBins[chunkIndex]};
+      for (const Item &item : chunk) {
+        ssize_t index{itemIndex(item)};
+        bins[index].first |= item.box;
+        bins[index].second++;
+      }
+    });
+    Bins bins{chunkBins[0]};
+    for (size_t chunkIndex = 1; chunkIndex < chunkBins.size(); chunkIndex++) {
+      for (ssize_t index = 0; index < Nbins; index++) {
+        bins[index].first |= chunkBins[chunkIndex][index].first;
+        bins[index].second += chunkBins[chunkIndex][index].second;
+      }
     }
 
     // Initialize sweeps.
-    std::array<Bin, Nbins - 1> sweepL{};
-    std::array<Bin, Nbins - 1> sweepR{};
-    {
-      auto sweepLItr = sweepL.begin(), binsLItr = bins.begin();
-      auto sweepRItr = sweepR.rbegin(), binsRItr = bins.rbegin();
-      *sweepLItr++ = *binsLItr++;
-      *sweepRItr++ = *binsRItr++;
-      for (; sweepLItr < sweepL.end(); ++sweepLItr, ++binsLItr, ++sweepRItr, ++binsRItr) {
-        sweepLItr->first = (sweepLItr - 1)->first | binsLItr->first;
-        sweepRItr->first = (sweepRItr - 1)->first | binsRItr->first;
-        sweepLItr->second = (sweepLItr - 1)->second + binsLItr->second;
-        sweepRItr->second = (sweepRItr - 1)->second + binsRItr->second;
-      }
+    Bins sweepL{};
+    Bins sweepR{};
+    sweepL[0] = bins[0];
+    sweepR[Nbins - 2] = bins[Nbins - 1];
+    for (ssize_t index = 1; index < Nbins - 1; index++) {
+      sweepL[index].first = sweepL[index - 1].first | bins[index].first;
+      sweepL[index].second = sweepL[index - 1].second + bins[index].second;
+      sweepR[Nbins - 2 - index].first = sweepR[Nbins - 1 - index].first | bins[Nbins - 1 - index].first;
+      sweepR[Nbins - 2 - index].second = sweepR[Nbins - 1 - index].second + bins[Nbins - 1 - index].second;
     }
 
     // Compute costs to find best split index.
@@ -102,6 +457,11 @@ public:
         minCostIndex = costIndex;
       }
     }
+    if (candidate) {
+      candidate->cost = minCost;
+      candidate->boxL = sweepL[minCostIndex].first;
+      candidate->boxR = sweepR[minCostIndex].first;
+    }
 
     // Partition.
     if (auto best = std::partition(items.begin(), items.end(), [&](auto &item) { return itemIndex(item) <= minCostIndex; });
@@ -141,13 +501,24 @@ public:
   }
 };
 
-template <size_t N> inline void ImmutableBVH<N>::build(int leafLimit, Items &items) {
-  if (leafLimit < 1) leafLimit = 1;
-
+template <size_t N> inline void ImmutableBVH<N>::build(const BuildOptions &options, Items &items) {
   // Run builder.
   ImmutableBVHBuilder<N> builder;
-  builder.leafLimit = leafLimit;
-  builder.build(items);
+  builder.leafLimit = std::max(options.leafLimit, 1);
+  builder.numBins = options.numBins;
+  builder.parallel = options.parallel;
+  if (options.spatialSplits) {
+    builder.clipper = options.clipper;
+    builder.spatialSplitAlpha = options.spatialSplitAlpha;
+    builder.spatialSplitBudget = std::max(options.spatialSplitBudget, 0.0f) * items.size();
+    builder.buildSpatial(items);
+  } else {
+    builder.build(items);
+  }
+  if (options.treeletLeaves > 0) {
+    builder.parallel = options.parallel;
+    builder.optimizeTreelets(options.treeletLeaves);
+  }
 
   // Collapse.
   nodes.clear();
@@ -158,4 +529,70 @@ template <size_t N> inline void ImmutableBVH<N>::build(int leafLimit, Items &ite
 template class ImmutableBVH<2>;
 template class ImmutableBVH<3>;
 
+template <size_t N, size_t Width> inline void ImmutableWideBVH<N, Width>::build(const BVH &bvh) {
+  nodes.clear();
+  if (bvh.nodes.empty()) return;
+  nodes.reserve(bvh.nodes.size() / 2 + 1);
+  auto collapse = [&](auto &&self, uint32_t binaryIndex) -> uint32_t {
+    // Gather the children by repeatedly opening up the branch child with the largest surface area, which is
+    // the child most likely to be hit, until there are Width children or there are no branches left to open.
+    uint32_t children[Width]{};
+    size_t numChildren{0};
+    const auto &binaryNode{bvh.nodes[binaryIndex]};
+    if (binaryNode.isLeaf()) {
+      children[numChildren++] = binaryIndex;
+    } else {
+      children[numChildren++] = binaryIndex + 1;
+      children[numChildren++] = binaryIndex + binaryNode.right;
+    }
+    while (numChildren < Width) {
+      ssize_t best{-1};
+      float bestArea{-1};
+      for (size_t k = 0; k < numChildren; k++) {
+        const auto &child{bvh.nodes[children[k]]};
+        if (child.isBranch() && child.box.hyperArea() > bestArea) best = k, bestArea = child.box.hyperArea();
+      }
+      if (best < 0) break;
+      uint32_t openIndex{children[best]};
+      children[best] = openIndex + 1;
+      children[numChildren++] = openIndex + bvh.nodes[openIndex].right;
+    }
+
+    // Allocate the node first so that the node order is depth-first, then recurse. Note that the vector may
+    // reallocate during recursion, so we must always go through the index.
+    uint32_t index{uint32_t(nodes.size())};
+    nodes.emplace_back();
+    for (size_t i = 0; i < N; i++) {
+      for (size_t k = 0; k < Width; k++) {
+        nodes[index].lower[i][k] = +constants::Inf<float>;
+        nodes[index].upper[i][k] = -constants::Inf<float>;
+      }
+    }
+    for (size_t k = 0; k < Width; k++) nodes[index].first[k] = 0, nodes[index].count[k] = 0;
+    nodes[index].numChildren = numChildren;
+    for (size_t k = 0; k < numChildren; k++) {
+      const auto &child{bvh.nodes[children[k]]};
+      for (size_t i = 0; i < N; i++) {
+        nodes[index].lower[i][k] = child.box.lower()[i];
+        nodes[index].upper[i][k] = child.box.upper()[i];
+      }
+      if (child.isLeaf()) {
+        nodes[index].first[k] = child.first;
+        nodes[index].count[k] = child.count;
+      } else {
+        uint32_t childIndex{self(self, children[k])};
+        nodes[index].first[k] = childIndex;
+        nodes[index].count[k] = 0;
+      }
+    }
+    return index;
+  };
+  collapse(collapse, 0);
+}
+
+template class ImmutableWideBVH<2, 4>;
+template class ImmutableWideBVH<2, 8>;
+template class ImmutableWideBVH<3, 4>;
+template class ImmutableWideBVH<3, 8>;
+
 } // namespace mi::geometry
@@ -0,0 +1,194 @@
+#include "Microcosm/Geometry/ImmutableBVH"
+#include "Microcosm/Timer"
+#include "testing.h"
+#include <omp.h>
+#include <set>
+
+TEST_CASE_TEMPLATE("ImmutableWideBVH", WideBVH, mi::geometry::ImmutableWideBVH3<4>, mi::geometry::ImmutableWideBVH3<8>) {
+  auto prng = PRNG();
+  std::vector<mi::BoundBox3f> boxes;
+  for (int i = 0; i < 500; i++) {
+    mi::Vector3f center{mi::randomize<mi::Vector3f>(prng) * 10.0f};
+    mi::Vector3f extent{mi::randomize<mi::Vector3f>(prng) * 0.5f};
+    boxes.emplace_back(center - extent, center + extent);
+  }
+  mi::geometry::ImmutableBVH3 bvh;
+  bvh.build(4, boxes);
+  WideBVH wideBVH;
+  wideBVH.build(bvh);
+  SUBCASE("Same leaves as binary ray cast") {
+    for (int i = 0; i < 200; i++) {
+      mi::Ray3d ray{mi::randomize<mi::Vector3d>(prng) * 10.0, normalize(mi::randomize<mi::Vector3d>(prng) * 2.0 - 1.0)};
+      std::set<uint32_t> firstsA;
+      std::set<uint32_t> firstsB;
+      bvh.visitRayCast(ray, [&](const auto &node) {
+        firstsA.insert(node.first);
+        return true;
+      });
+      wideBVH.visitRayCast(ray, [&](uint32_t first, uint32_t count) {
+        CHECK(count > 0);
+        firstsB.insert(first);
+        return true;
+      });
+      CHECK(firstsA == firstsB);
+    }
+  }
+  SUBCASE("Nearest hit with shrinking ray") {
+    for (int i = 0; i < 200; i++) {
+      mi::Ray3d ray{mi::randomize<mi::Vector3d>(prng) * 10.0, normalize(mi::randomize<mi::Vector3d>(prng) * 2.0 - 1.0)};
+      double expectParam{mi::constants::Inf<double>};
+      for (const auto &box : boxes)
+        if (auto params = mi::BoundBox3d(box).rayCast(ray)) expectParam = std::min(expectParam, std::max(params->first, 0.0));
+      double actualParam{mi::constants::Inf<double>};
+      wideBVH.visitRayCast(ray, [&](uint32_t first, uint32_t count) {
+        for (uint32_t j = first; j < first + count; j++) {
+          if (auto params = mi::BoundBox3d(boxes[j]).rayCast(ray)) {
+            actualParam = std::min(actualParam, std::max(params->first, 0.0));
+            ray.maxParam = actualParam;
+          }
+        }
+        return true;
+      });
+      CHECK(actualParam == expectParam);
+    }
+  }
+  SUBCASE("Packet and stream match single ray cast") {
+    std::vector<mi::Ray3d> rays;
+    for (int i = 0; i < 100; i++) rays.emplace_back(mi::randomize<mi::Vector3d>(prng) * 10.0, normalize(mi::randomize<mi::Vector3d>(prng) * 2.0 - 1.0));
+    std::vector<std::set<uint32_t>> firsts(rays.size());
+    std::vector<std::set<uint32_t>> firstsPacket(rays.size());
+    std::vector<std::set<uint32_t>> firstsStream(rays.size());
+    for (size_t j = 0; j < rays.size(); j++) {
+      wideBVH.visitRayCast(rays[j], [&](uint32_t first, uint32_t) {
+        firsts[j].insert(first);
+        return true;
+      });
+    }
+    wideBVH.visitRayCastPacket(std::span<mi::Ray3d>(rays), [&](uint32_t first, uint32_t, uint32_t j) {
+      firstsPacket[j].insert(first);
+      return true;
+    });
+    wideBVH.visitRayCastStream(std::span<mi::Ray3d>(rays), [&](uint32_t first, uint32_t, uint32_t j) {
+      firstsStream[j].insert(first);
+      return true;
+    });
+    CHECK(firsts == firstsPacket);
+    CHECK(firsts == firstsStream);
+  }
+  SUBCASE("Packet and stream respect shrinking maximum parameter") {
+    std::vector<mi::Ray3d> rays;
+    for (int i = 0; i < 100; i++) rays.emplace_back(mi::randomize<mi::Vector3d>(prng) * 10.0, normalize(mi::randomize<mi::Vector3d>(prng) * 2.0 - 1.0));
+    std::vector<mi::Ray3d> raysStream{rays};
+    std::vector<int> visits(rays.size());
+    std::vector<int> visitsStream(rays.size());
+    wideBVH.visitRayCastPacket(std::span<mi::Ray3d>(rays), [&](uint32_t, uint32_t, uint32_t j) {
+      rays[j].maxParam = -1; // Cull everything else.
+      visits[j]++;
+      return true;
+    });
+    wideBVH.visitRayCastStream(std::span<mi::Ray3d>(raysStream), [&](uint32_t, uint32_t, uint32_t j) {
+      raysStream[j].maxParam = -1;
+      visitsStream[j]++;
+      return true;
+    });
+    for (size_t j = 0; j < rays.size(); j++) {
+      CHECK(visits[j] <= 1);
+      CHECK(visitsStream[j] <= 1);
+    }
+  }
+}
+
+static std::vector<mi::BoundBox3f> randomBoxes(auto &prng, int count) {
+  std::vector<mi::BoundBox3f> boxes;
+  for (int i = 0; i < count; i++) {
+    mi::Vector3f center{mi::randomize<mi::Vector3f>(prng) * 100.0f};
+    mi::Vector3f extent{mi::randomize<mi::Vector3f>(prng) * 0.5f};
+    boxes.emplace_back(center - extent, center + extent);
+  }
+  return boxes;
+}
+
+TEST_CASE("ImmutableBVH") {
+  auto prng = PRNG();
+  SUBCASE("Parallel build matches serial build") {
+    auto boxes = randomBoxes(prng, 100000);
+    int numThreads = omp_get_max_threads();
+    omp_set_num_threads(4);
+    mi::geometry::ImmutableBVH3 bvhA;
+    mi::geometry::ImmutableBVH3 bvhB;
+    auto boxesA = boxes;
+    auto boxesB = boxes;
+    bvhA.build({.leafLimit = 4, .numBins = 16, .parallel = false, .treeletLeaves = 7}, boxesA);
+    bvhB.build({.leafLimit = 4, .numBins = 16, .parallel = true, .treeletLeaves = 7}, boxesB);
+    omp_set_num_threads(numThreads);
+    CHECK(bvhA.nodes.size() == bvhB.nodes.size());
+    CHECK(std::memcmp(bvhA.nodes.data(), bvhB.nodes.data(), sizeof(bvhA.nodes[0]) * bvhA.nodes.size()) == 0);
+    CHECK(std::memcmp(boxesA.data(), boxesB.data(), sizeof(boxesA[0]) * boxesA.size()) == 0);
+  }
+  SUBCASE("Spatial splits and treelets still find every hit") {
+    // Long thin boxes, which is where spatial splits help.
+    std::vector<mi::BoundBox3f> boxes;
+    for (int i = 0; i < 2000; i++) {
+      mi::Vector3f center{mi::randomize<mi::Vector3f>(prng) * 10.0f};
+      mi::Vector3f extent{mi::randomize<mi::Vector3f>(prng) * 0.1f};
+      extent[i % 3] = 5;
+      boxes.emplace_back(center - extent, center + extent);
+    }
+    mi::geometry::ImmutableBVH3::Items items;
+    for (size_t i = 0; i < boxes.size(); i++) items.push_back({uint32_t(i), boxes[i], boxes[i].center()});
+    mi::geometry::ImmutableBVH3 bvh;
+    bvh.build({.leafLimit = 4, .spatialSplits = true, .spatialSplitBudget = 1.0f, .treeletLeaves = 7}, items);
+    CHECK(items.size() > boxes.size());
+    CHECK(items.size() <= 2 * boxes.size());
+    for (int i = 0; i < 100; i++) {
+      mi::Ray3d ray{mi::randomize<mi::Vector3d>(prng) * 10.0, normalize(mi::randomize<mi::Vector3d>(prng) * 2.0 - 1.0)};
+      std::set<uint32_t> expect;
+      std::set<uint32_t> actual;
+      for (size_t j = 0; j < boxes.size(); j++)
+        if (mi::BoundBox3d(boxes[j]).rayCast(ray)) expect.insert(j);
+      bvh.visitRayCast(ray, [&](const auto &node) {
+        for (uint32_t j = node.first; j < node.first + node.count; j++) actual.insert(items[j].index);
+        return true;
+      });
+      CHECK(std::includes(actual.begin(), actual.end(), expect.begin(), expect.end()));
+    }
+  }
+  SUBCASE("Spatial splits never exceed the budget") {
+    std::vector<mi::BoundBox3f> boxes;
+    for (int i = 0; i < 2000; i++) {
+      mi::Vector3f center{mi::randomize<mi::Vector3f>(prng) * 10.0f};
+      mi::Vector3f extent{mi::randomize<mi::Vector3f>(prng) * 0.1f};
+      extent[i % 3] = 5;
+      boxes.emplace_back(center - extent, center + extent);
+    }
+    for (float budget : {0.0f, 0.01f, 0.1f}) {
+      mi::geometry::ImmutableBVH3::Items items;
+      for (size_t i = 0; i < boxes.size(); i++) items.push_back({uint32_t(i), boxes[i], boxes[i].center()});
+      mi::geometry::ImmutableBVH3 bvh;
+      bvh.build({.leafLimit = 4, .spatialSplits = true, .spatialSplitBudget = budget}, items);
+      CHECK(items.size() <= boxes.size() + size_t(budget * boxes.size()));
+    }
+  }
+}
+
+TEST_CASE("ImmutableBVH build benchmark" * doctest::skip()) {
+  // Build time versus thread count, with the serial build for reference, as the best of three. Run with --no-skip.
+  auto prng = PRNG();
+  auto boxes = randomBoxes(prng, 2000000);
+  int maxThreads{omp_get_max_threads()};
+  for (int numThreads = 1; numThreads <= omp_get_num_procs(); numThreads *= 2) {
+    omp_set_num_threads(numThreads);
+    for (bool parallel : {false, true}) {
+      double seconds{mi::constants::Inf<double>};
+      for (int trial = 0; trial < 3; trial++) {
+        mi::geometry::ImmutableBVH3 bvh;
+        std::vector<mi::BoundBox3f> boxesCopy{boxes};
+        mi::Timer<std::chrono::high_resolution_clock> timer;
+        bvh.build({.leafLimit = 4, .parallel = parallel}, boxesCopy);
+        seconds = std::min(seconds, timer.seconds());
+      }
+      std::cout << numThreads << " threads, " << (parallel ? "parallel" : "serial") << ": " << seconds << " s" << std::endl;
+    }
+  }
+  omp_set_num_threads(maxThreads);
+}
@@ -0,0 +1,46 @@
+#include "Microcosm/Geometry/ImmutableKDTree"
+#include "testing.h"
+#include <set>
+
+TEST_CASE("ImmutableKDTree") {
+  auto prng = PRNG();
+  std::vector<mi::Vector3f> points;
+  for (int i = 0; i < 1000; i++) points.push_back(mi::randomize<mi::Vector3f>(prng) * 10.0f);
+  mi::geometry::ImmutableKDTree3 tree;
+  tree.build(points);
+  REQUIRE(tree.nodes.size() == points.size());
+  SUBCASE("Radius query matches brute force") {
+    for (int k = 0; k < 200; k++) {
+      mi::Vector3f center{mi::randomize<mi::Vector3f>(prng) * 12.0f - 1.0f};
+      float radius{3.0f * mi::randomize<float>(prng)};
+      std::multiset<uint32_t> indexesA;
+      std::multiset<uint32_t> indexesB;
+      tree.visit(center, radius, [&](const auto &node) {
+        CHECK(mi::allTrue(node.point == points[node.index]));
+        indexesA.insert(node.index);
+        return true;
+      });
+      for (uint32_t i = 0; i < points.size(); i++)
+        if (mi::distanceSquare(points[i], center) < radius * radius) indexesB.insert(i);
+      CHECK(indexesA == indexesB);
+    }
+  }
+  SUBCASE("Radius query stops when the visitor returns false") {
+    int numVisits{0};
+    tree.visit(mi::Vector3f(5.0f), 20.0f, [&](const auto &) {
+      numVisits++;
+      return false;
+    });
+    CHECK(numVisits == 1);
+  }
+  SUBCASE("Nearest matches brute force") {
+    for (int k = 0; k < 200; k++) {
+      mi::Vector3f point{mi::randomize<mi::Vector3f>(prng) * 12.0f - 1.0f};
+      float bestDist{mi::constants::Inf<float>};
+      for (const auto &each : points) bestDist = std::min(bestDist, mi::distance(each, point));
+      auto nearest{tree.nearestTo(point)};
+      REQUIRE(nearest.node != nullptr);
+      CHECK(nearest.dist == Approx(bestDist).epsilon(1e-5));
+    }
+  }
+}
@@ -0,0 +1,138 @@
+#include "Microcosm/Render/Distribution2D"
+
+namespace mi::render {
+
+static void checkWeights(const char *function, Vector2i count, const std::vector<double> &weights) {
+  if (!(count[0] > 0 && count[1] > 0)) [[unlikely]]
+    throw Error(std::invalid_argument(std::string("Call to ") + function + "() failed! Reason: Count must be positive"));
+  if (weights.size() != size_t(count[0]) * size_t(count[1])) [[unlikely]]
+    throw Error(std::invalid_argument(std::string("Call to ") + function + "() failed! Reason: Number of weights does not match count"));
+}
+
+/// The cell index of the given coordinate in the unit interval, for the given number of cells.
+[[nodiscard]] static int cellIndex(double value, int count) noexcept { return clamp(int(value * count), 0, count - 1); }
+
+PiecewiseConstant2D::PiecewiseConstant2D(Vector2i count, const std::vector<double> &weights) : mCount(count) {
+  checkWeights("PiecewiseConstant2D", count, weights);
+  std::vector<double> rowIntegrals(count[1]);
+  mConditionals.reserve(count[1]);
+  for (int j = 0; j < count[1]; j++) {
+    auto row{weights.begin() + ptrdiff_t(j) * count[0]};
+    rowIntegrals[j] = mConditionals.emplace_back(std::vector<double>(row, row + count[0])).integral();
+  }
+  mMarginal = distributions::PiecewiseConstant(rowIntegrals);
+}
+
+double PiecewiseConstant2D::distributionPDF(Vector2d point) const noexcept {
+  if (mConditionals.empty() || !allTrue((0 <= point) & (point < 1))) return 0;
+  return mMarginal.distributionPDF(point[1]) * mConditionals[cellIndex(point[1], mCount[1])].distributionPDF(point[0]);
+}
+
+Vector2d PiecewiseConstant2D::distributionSample(Vector2d sampleU) const noexcept {
+  if (mConditionals.empty()) return {};
+  int j{0};
+  double y{mMarginal.distributionSample(sampleU[1], j)};
+  return {mConditionals[j].distributionSample(sampleU[0]), y};
+}
+
+Vector2d PiecewiseConstant2D::inverse(Vector2d point) const noexcept {
+  if (mConditionals.empty()) return {};
+  return {mConditionals[cellIndex(point[1], mCount[1])].distributionCDF(point[0]), mMarginal.distributionCDF(point[1])};
+}
+
+HierarchicalWarp2D::HierarchicalWarp2D(Vector2i count, const std::vector<double> &weights) : mCount(count) {
+  checkWeights("HierarchicalWarp2D", count, weights);
+  Level &finest{mLevels.emplace_back()};
+  finest.count = {int(std::bit_ceil(unsigned(count[0]))), int(std::bit_ceil(unsigned(count[1])))};
+  finest.weights.resize(size_t(finest.count[0]) * size_t(finest.count[1]));
+  double total{0};
+  for (int j = 0; j < count[1]; j++)
+    for (int i = 0; i < count[0]; i++) total += finest.weights[size_t(j) * size_t(finest.count[0]) + size_t(i)] = max(weights[size_t(j) * size_t(count[0]) + size_t(i)], 0.0);
+  mIntegral = total / (double(count[0]) * double(count[1]));
+  if (!(total > 0)) {
+    // Fall back to the uniform distribution over the cells that are not padding.
+    for (int j = 0; j < count[1]; j++)
+      for (int i = 0; i < count[0]; i++) finest.weights[size_t(j) * size_t(finest.count[0]) + size_t(i)] = 1;
+  }
+  while (mLevels.back().count[0] > 1 || mLevels.back().count[1] > 1) {
+    const Level &below{mLevels.back()};
+    Level level;
+    level.count = {max(below.count[0] / 2, 1), max(below.count[1] / 2, 1)};
+    level.weights.resize(size_t(level.count[0]) * size_t(level.count[1]));
+    const int strideX{below.count[0] / level.count[0]};
+    const int strideY{below.count[1] / level.count[1]};
+    for (int j = 0; j < level.count[1]; j++)
+      for (int i = 0; i < level.count[0]; i++)
+        for (int dj = 0; dj < strideY; dj++)
+          for (int di = 0; di < strideX; di++) level.weights[size_t(j) * size_t(level.count[0]) + size_t(i)] += below(strideX * i + di, strideY * j + dj);
+    mLevels.push_back(std::move(level));
+  }
+}
+
+double HierarchicalWarp2D::distributionPDF(Vector2d point) const noexcept {
+  if (mLevels.empty() || !allTrue((0 <= point) & (point < 1))) return 0;
+  return mLevels[0](cellIndex(point[0], mCount[0]), cellIndex(point[1], mCount[1])) / mLevels.back().weights[0] * (double(mCount[0]) * double(mCount[1]));
+}
+
+/// The probability of choosing the first of two halves with the given weights.
+[[nodiscard]] static double splitProbability(double weight0, double weight1) noexcept { return weight0 + weight1 > 0 ? weight0 / (weight0 + weight1) : 0.5; }
+
+Vector2d HierarchicalWarp2D::distributionSample(Vector2d sampleU) const noexcept {
+  if (mLevels.empty()) return {};
+  sampleU = {clamp(sampleU[0], 0.0, distributions::OneMinusEpsilon), clamp(sampleU[1], 0.0, distributions::OneMinusEpsilon)};
+  int i{0};
+  int j{0};
+  for (size_t levelIndex = mLevels.size() - 1; levelIndex-- > 0;) {
+    const Level &level{mLevels[levelIndex]};
+    const bool splitX{level.count[0] > mLevels[levelIndex + 1].count[0]};
+    const bool splitY{level.count[1] > mLevels[levelIndex + 1].count[1]};
+    if (splitX) i *= 2;
+    if (splitY) j *= 2;
+    if (splitX) {
+      double prob0{splitProbability(level(i, j) + (splitY ? level(i, j + 1) : 0), level(i + 1, j) + (splitY ? level(i + 1, j + 1) : 0))};
+      if (sampleU[0] < prob0) {
+        sampleU[0] = min(sampleU[0] / prob0, distributions::OneMinusEpsilon);
+      } else {
+        sampleU[0] = min((sampleU[0] - prob0) / (1 - prob0), distributions::OneMinusEpsilon), i++;
+      }
+    }
+    if (splitY) {
+      double prob0{splitProbability(level(i, j), level(i, j + 1))};
+      if (sampleU[1] < prob0) {
+        sampleU[1] = min(sampleU[1] / prob0, distributions::OneMinusEpsilon);
+      } else {
+        sampleU[1] = min((sampleU[1] - prob0) / (1 - prob0), distributions::OneMinusEpsilon), j++;
+      }
+    }
+  }
+  return {min((i + sampleU[0]) / mCount[0], distributions::OneMinusEpsilon), min((j + sampleU[1]) / mCount[1], distributions::OneMinusEpsilon)};
+}
+
+Vector2d HierarchicalWarp2D::inverse(Vector2d point) const noexcept {
+  if (mLevels.empty()) return {};
+  // Undo the choices from the bottom of the pyramid up, in the reverse order of distributionSample().
+  int i{cellIndex(point[0], mCount[0])};
+  int j{cellIndex(point[1], mCount[1])};
+  Vector2d sampleU{saturate(point[0] * mCount[0] - i), saturate(point[1] * mCount[1] - j)};
+  for (size_t levelIndex = 0; levelIndex + 1 < mLevels.size(); levelIndex++) {
+    const Level &level{mLevels[levelIndex]};
+    const bool splitX{level.count[0] > mLevels[levelIndex + 1].count[0]};
+    const bool splitY{level.count[1] > mLevels[levelIndex + 1].count[1]};
+    if (splitY) {
+      int j0{j & ~1};
+      double prob0{splitProbability(level(i, j0), level(i, j0 + 1))};
+      sampleU[1] = j == j0 ? sampleU[1] * prob0 : prob0 + sampleU[1] * (1 - prob0);
+      j /= 2;
+    }
+    if (splitX) {
+      int i0{i & ~1};
+      int j0{splitY ? 2 * j : j};
+      double prob0{splitProbability(level(i0, j0) + (splitY ? level(i0, j0 + 1) : 0), level(i0 + 1, j0) + (splitY ? level(i0 + 1, j0 + 1) : 0))};
+      sampleU[0] = i == i0 ? sampleU[0] * prob0 : prob0 + sampleU[0] * (1 - prob0);
+      i /= 2;
+    }
+  }
+  return {min(sampleU[0], distributions::OneMinusEpsilon), min(sampleU[1], distributions::OneMinusEpsilon)};
+}
+
+} // namespace mi::render
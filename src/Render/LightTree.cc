@@ -0,0 +1,207 @@
+#include "Microcosm/Render/LightTree"
+
+namespace mi::render {
+
+/// The cosine of the difference of angles A and B, or 1 if B is greater than A.
+[[nodiscard]] static double cosSubClamped(double sinThetaA, double cosThetaA, double sinThetaB, double cosThetaB) noexcept {
+  return cosThetaA > cosThetaB ? 1 : cosThetaA * cosThetaB + sinThetaA * sinThetaB;
+}
+
+/// The sine of the difference of angles A and B, or 0 if B is greater than A.
+[[nodiscard]] static double sinSubClamped(double sinThetaA, double cosThetaA, double sinThetaB, double cosThetaB) noexcept {
+  return cosThetaA > cosThetaB ? 0 : sinThetaA * cosThetaB - cosThetaA * sinThetaB;
+}
+
+double LightTree::Bounds::importance(Vector3d point, Vector3d normal) const noexcept {
+  if (!(power > 0)) return 0;
+  // Clamp the squared distance from below by a fraction of the size of the box, so that the estimate does not blow up
+  // for points near (or inside) the box, where the distance to the center is meaningless.
+  Vector3d center{box.center()};
+  Vector3d omega{point - center};
+  double distSqr{max(lengthSquare(omega), 0.5 * length(box.extent()))};
+  omega = normalize(omega);
+  if (!allTrue(isfinite(omega))) omega = axis;
+
+  // The angle between the axis and the direction to the point.
+  double cosThetaW{dot(axis, omega)};
+  if (twoSided) cosThetaW = abs(cosThetaW);
+  double sinThetaW{safeSqrt(1 - sqr(cosThetaW))};
+
+  // The half-angle of the cone of directions the box subtends from the point, bounding it with a sphere.
+  double radiusSqr{0.25 * lengthSquare(box.extent())};
+  double centerDistSqr{distanceSquare(point, center)};
+  double cosThetaB{centerDistSqr < radiusSqr ? -1 : safeSqrt(1 - radiusSqr / centerDistSqr)};
+  double sinThetaB{safeSqrt(1 - sqr(cosThetaB))};
+
+  // The minimum angle between the emission directions and the direction to the point, which is the angle to the axis
+  // minus the normal cone angle, minus the subtended angle.
+  double sinThetaO{safeSqrt(1 - sqr(cosThetaO))};
+  double cosThetaX{cosSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO)};
+  double sinThetaX{sinSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO)};
+  double cosThetaP{cosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB)};
+  if (cosThetaP <= cosThetaE) return 0;
+  double result{power * cosThetaP / distSqr};
+
+  // The minimum angle between the normal at the point and the direction to the box.
+  if (!allTrue(normal == 0)) {
+    double cosThetaI{absDot(omega, normal)};
+    double sinThetaI{safeSqrt(1 - sqr(cosThetaI))};
+    result *= cosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+  }
+  return max(result, 0.0);
+}
+
+LightTree::Bounds LightTree::merge(const Bounds &boundsA, const Bounds &boundsB) noexcept {
+  if (!(boundsA.power > 0)) return boundsB;
+  if (!(boundsB.power > 0)) return boundsA;
+  Bounds bounds;
+  bounds.box = boundsA.box | boundsB.box;
+  bounds.cosThetaE = min(boundsA.cosThetaE, boundsB.cosThetaE);
+  bounds.power = boundsA.power + boundsB.power;
+  bounds.twoSided = boundsA.twoSided || boundsB.twoSided;
+
+  // Merge the normal cones. If either cone contains the other, the result is just the larger one. Otherwise, the
+  // result spans both, with the axis rotated from the first axis toward the second.
+  double thetaA{acos(clamp(boundsA.cosThetaO, -1.0, 1.0))};
+  double thetaB{acos(clamp(boundsB.cosThetaO, -1.0, 1.0))};
+  double thetaD{acos(clamp(dot(boundsA.axis, boundsB.axis), -1.0, 1.0))};
+  if (min(thetaD + thetaB, Pi) <= thetaA) {
+    bounds.axis = boundsA.axis, bounds.cosThetaO = boundsA.cosThetaO;
+  } else if (min(thetaD + thetaA, Pi) <= thetaB) {
+    bounds.axis = boundsB.axis, bounds.cosThetaO = boundsB.cosThetaO;
+  } else if (double thetaO{0.5 * (thetaA + thetaD + thetaB)}; thetaO >= Pi) {
+    bounds.axis = boundsA.axis, bounds.cosThetaO = -1;
+  } else if (Vector3d rotationAxis{cross(boundsA.axis, boundsB.axis)}; lengthSquare(rotationAxis) == 0) {
+    bounds.axis = boundsA.axis, bounds.cosThetaO = -1;
+  } else {
+    double thetaR{thetaO - thetaA};
+    rotationAxis = normalize(rotationAxis);
+    bounds.axis = normalize(cos(thetaR) * boundsA.axis + sin(thetaR) * cross(rotationAxis, boundsA.axis));
+    bounds.cosThetaO = cos(thetaO);
+  }
+  return bounds;
+}
+
+LightTree::LightTree(std::vector<Emitter> emitters, const geometry::ImmutableBVH3::BuildOptions &options) {
+  if (options.spatialSplits) [[unlikely]]
+    throw Error(std::invalid_argument("Call to LightTree() failed! Reason: Spatial splits are not supported"));
+  if (emitters.empty()) return;
+  geometry::ImmutableBVH3::Items items(emitters.size());
+  for (size_t i = 0; i < emitters.size(); i++) {
+    const Emitter &emitter{emitters[i]};
+    if (!(emitter.power >= 0 && isfinite(emitter.power))) [[unlikely]]
+      throw Error(std::invalid_argument("Call to LightTree() failed! Reason: Emitter power must be non-negative and finite"));
+    items[i].index = uint32_t(i);
+    for (size_t k = 0; k < 3; k++) {
+      items[i].box[0][k] = std::nextafter(float(emitter.box[0][k]), -constants::Inf<float>);
+      items[i].box[1][k] = std::nextafter(float(emitter.box[1][k]), +constants::Inf<float>);
+    }
+    items[i].boxCenter = items[i].box.center();
+  }
+  mBVH.build(options, items);
+  mEmitterBounds.resize(items.size());
+  mEmitterIndexes.resize(items.size());
+  for (size_t i = 0; i < items.size(); i++) {
+    const Emitter &emitter{emitters[items[i].index]};
+    Bounds &bounds{mEmitterBounds[i]};
+    bounds.box = emitter.box;
+    bounds.axis = normalize(emitter.axis);
+    bounds.cosThetaO = emitter.cosThetaO;
+    bounds.cosThetaE = emitter.cosThetaE;
+    bounds.power = emitter.power;
+    bounds.twoSided = emitter.twoSided;
+    mEmitterIndexes[i] = items[i].index;
+  }
+
+  // The children always come after their parents in the node array, so visiting the nodes in reverse order
+  // guarantees that the bounds of the children are ready before the bounds of the parent.
+  const size_t numNodes{mBVH.nodes.size()};
+  mNodeBounds.resize(numNodes);
+  mNodeParents.resize(numNodes);
+  mEmitterLeaves.resize(emitters.size());
+  for (size_t i = 0; i < numNodes; i++) {
+    const auto &node{mBVH.nodes[i]};
+    if (node.isBranch()) mNodeParents[i + 1] = mNodeParents[i + node.right] = uint32_t(i);
+  }
+  for (size_t i = numNodes; i-- > 0;) {
+    const auto &node{mBVH.nodes[i]};
+    if (node.isBranch()) {
+      mNodeBounds[i] = merge(mNodeBounds[i + 1], mNodeBounds[i + node.right]);
+    } else {
+      Bounds bounds{mEmitterBounds[node.first]};
+      for (uint32_t j = node.first; j < node.first + node.count; j++) {
+        if (j > node.first) bounds = merge(bounds, mEmitterBounds[j]);
+        mEmitterLeaves[mEmitterIndexes[j]] = uint32_t(i);
+      }
+      mNodeBounds[i] = bounds;
+    }
+  }
+}
+
+std::optional<std::pair<size_t, double>> LightTree::sample(double sampleU, Vector3d point, Vector3d normal) const noexcept {
+  if (mBVH.nodes.empty()) return std::nullopt;
+  double prob{1};
+  size_t nodeIndex{0};
+  while (mBVH.nodes[nodeIndex].isBranch()) {
+    const auto &node{mBVH.nodes[nodeIndex]};
+    double importance0{mNodeBounds[nodeIndex + 1].importance(point, normal)};
+    double importance1{mNodeBounds[nodeIndex + node.right].importance(point, normal)};
+    if (!(importance0 > 0) && !(importance1 > 0)) return std::nullopt;
+    double prob0{importance0 / (importance0 + importance1)};
+    if (sampleU < prob0) {
+      sampleU = min(sampleU / prob0, distributions::OneMinusEpsilon);
+      prob *= prob0;
+      nodeIndex += 1;
+    } else {
+      sampleU = min((sampleU - prob0) / (1 - prob0), distributions::OneMinusEpsilon);
+      prob *= 1 - prob0;
+      nodeIndex += node.right;
+    }
+  }
+  const auto &node{mBVH.nodes[nodeIndex]};
+  if (node.count == 1) {
+    if (!(mNodeBounds[nodeIndex].importance(point, normal) > 0)) return std::nullopt;
+    return std::pair{size_t(mEmitterIndexes[node.first]), prob};
+  }
+  double importanceSum{0};
+  for (uint32_t j = node.first; j < node.first + node.count; j++) importanceSum += mEmitterBounds[j].importance(point, normal);
+  if (!(importanceSum > 0)) return std::nullopt;
+  sampleU *= importanceSum;
+  for (uint32_t j = node.first; j < node.first + node.count; j++) {
+    double importance{mEmitterBounds[j].importance(point, normal)};
+    if (sampleU < importance || (j + 1 == node.first + node.count && importance > 0)) return std::pair{size_t(mEmitterIndexes[j]), prob * importance / importanceSum};
+    sampleU -= importance;
+  }
+  return std::nullopt;
+}
+
+double LightTree::probability(size_t emitterIndex, Vector3d point, Vector3d normal) const noexcept {
+  if (emitterIndex >= mEmitterLeaves.size()) return 0;
+  size_t nodeIndex{mEmitterLeaves[emitterIndex]};
+  double prob{1};
+  if (const auto &node{mBVH.nodes[nodeIndex]}; node.count > 1) {
+    double importance{0};
+    double importanceSum{0};
+    for (uint32_t j = node.first; j < node.first + node.count; j++) {
+      double each{mEmitterBounds[j].importance(point, normal)};
+      if (mEmitterIndexes[j] == emitterIndex) importance = each;
+      importanceSum += each;
+    }
+    if (!(importance > 0)) return 0;
+    prob = importance / importanceSum;
+  } else if (!(mNodeBounds[nodeIndex].importance(point, normal) > 0)) {
+    return 0;
+  }
+  while (nodeIndex != 0) {
+    size_t parentIndex{mNodeParents[nodeIndex]};
+    size_t siblingIndex{nodeIndex == parentIndex + 1 ? parentIndex + mBVH.nodes[parentIndex].right : parentIndex + 1};
+    double importance{mNodeBounds[nodeIndex].importance(point, normal)};
+    double importanceSibling{mNodeBounds[siblingIndex].importance(point, normal)};
+    if (!(importance > 0)) return 0;
+    prob *= importance / (importance + importanceSibling);
+    nodeIndex = parentIndex;
+  }
+  return prob;
+}
+
+} // namespace mi::render
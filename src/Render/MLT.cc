@@ -1,4 +1,5 @@
 #include "Microcosm/Render/MLT"
+#include <omp.h>
 
 namespace mi::render {
 
@@ -38,7 +39,7 @@ void PSMLTRandom::finishAndReject() {
   --mIteration;
 }
 
-void PSMLTIntegrator::operator()(const RandomSampler &randomSampler, const Recorder &recorder) const {
+PSMLTIntegrator::Statistics PSMLTIntegrator::operator()(const RandomSampler &randomSampler, const Recorder &recorder) const {
   const bool printProgress{mOptions.printProgress};
   const size_t seed{mOptions.seed};
   const size_t minBounces{mOptions.minBounces};
@@ -47,6 +48,8 @@ void PSMLTIntegrator::operator()(const RandomSampler &randomSampler, const Recor
   const size_t numBootstrapBounces{maxBounces - minBounces + 1};
   const size_t numMutations{mOptions.numMutations};
   const size_t numChains{mOptions.numChains};
+  const size_t numReplicas{max(mOptions.numReplicas, size_t(1))};
+  const size_t numMutationsPerExchange{max(mOptions.numMutationsPerExchange, size_t(1))};
 
   auto doRandomSample = [&](Random &random, size_t numBounces) -> std::optional<Contribution> {
     random.as<PSMLTRandom>().nextSequence();
@@ -68,7 +71,7 @@ void PSMLTIntegrator::operator()(const RandomSampler &randomSampler, const Recor
 #pragma omp parallel for schedule(dynamic)
   for (size_t pathIndex = 0; pathIndex < numBootstrapPaths; pathIndex++) {
     for (size_t bounceIndex = minBounces; bounceIndex <= maxBounces; bounceIndex++) {
-      size_t bootstrapIndex{pathIndex * numBootstrapBounces + bounceIndex};
+      size_t bootstrapIndex{pathIndex * numBootstrapBounces + (bounceIndex - minBounces)};
       Random random{PSMLTRandom{ExtendedPcg32<>{std::seed_seq{seed, 0xA7CBE565UL, 0x6AF93C73UL, bootstrapIndex, 0xE5C6FB2CUL, 0x24718FB5UL}}, mOptions.smallStepSigma, mOptions.largeStepProbability}};
       if (std::optional<Contribution> contribution{doRandomSample(random, bounceIndex)}) bootstrapValues[bootstrapIndex] = contribution->pathI;
     }
@@ -76,38 +79,145 @@ void PSMLTIntegrator::operator()(const RandomSampler &randomSampler, const Recor
   double overallValue{0};
   for (double value : bootstrapValues) overallValue += value;
   overallValue /= numBootstrapPaths;
+
+  // The bootstrap distributions conditioned on every number of bounces, to seed the tempered replicas.
+  std::vector<distributions::Discrete> bootstrapPerBounces;
+  if (numReplicas > 1) {
+    bootstrapPerBounces.reserve(numBootstrapBounces);
+    for (size_t bounceOffset = 0; bounceOffset < numBootstrapBounces; bounceOffset++) {
+      std::vector<double> values(numBootstrapPaths);
+      for (size_t pathIndex = 0; pathIndex < numBootstrapPaths; pathIndex++) values[pathIndex] = bootstrapValues[pathIndex * numBootstrapBounces + bounceOffset];
+      bootstrapPerBounces.emplace_back(std::move(values));
+    }
+  }
   distributions::Discrete bootstrap(std::move(bootstrapValues));
 
-  Progress progress{"Rendering", numMutations};
+  // The inverse temperatures of the replicas, where the first is always the untempered recording replica.
+  std::vector<double> inverseTemperatures(numReplicas, 1.0);
+  for (size_t replicaIndex = 1; replicaIndex < numReplicas; replicaIndex++) inverseTemperatures[replicaIndex] = pow(mOptions.minInverseTemperature, double(replicaIndex) / double(numReplicas - 1));
+
+  // The per-thread statistics, merged at the end.
+  std::vector<Statistics> threadStatistics(omp_get_max_threads());
+  for (auto &statistics : threadStatistics) statistics.contributionPerBounces.resize(maxBounces + 1);
+
+  struct Replica {
+    Random random;
+    ExtendedPcg32<> otherRandom;
+    std::optional<Contribution> CCurr;
+    std::optional<Contribution> CNext;
+  };
+
+  std::optional<Progress> progress;
+  if (printProgress) progress.emplace("Rendering", numMutations);
 #pragma omp parallel for schedule(dynamic)
   for (size_t chainIndex = 0; chainIndex < numChains; chainIndex++) {
-    ExtendedPcg32<> otherRandom{std::seed_seq{chainIndex, 0x3D6411FFUL, 0xDE44B7D2UL, seed, 0xE9F523E9UL, 0xD64CFEEEUL}};
-    const size_t bootstrapIndex{static_cast<size_t>(bootstrap(otherRandom))};
-    const size_t numBounces{bootstrapIndex % numBootstrapBounces + minBounces};
+    Statistics &statistics{threadStatistics[omp_get_thread_num()]};
     const size_t numMutationsStep0{((chainIndex + 0) * numMutations) / numChains};
     const size_t numMutationsStep1{((chainIndex + 1) * numMutations) / numChains};
     const size_t numChainMutations{min(numMutationsStep1, numMutations) - numMutationsStep0};
-    Random random{PSMLTRandom{ExtendedPcg32<>{std::seed_seq{seed, 0xA7CBE565UL, 0x6AF93C73UL, bootstrapIndex, 0xE5C6FB2CUL, 0x24718FB5UL}}, mOptions.smallStepSigma, mOptions.largeStepProbability}};
-    std::optional<Contribution> CCurr{doRandomSample(random, numBounces)};
-    std::optional<Contribution> CNext;
-    if (!CCurr) [[unlikely]] {
-      throw Error(std::logic_error("Bootstrap contribution should have been non-null!"));
+    // The number of bounces is bootstrapped once for the whole chain, and shared by every replica. The exchanges then
+    // never move the recording replica between numbers of bounces, so the time it spends at each number of bounces
+    // stays proportional to the bootstrap weight, which the multiplier overallValue / pathI relies on. The tempered
+    // replicas are seeded from the bootstrap paths with the same number of bounces.
+    size_t numBounces{0};
+    std::vector<Replica> replicas;
+    replicas.reserve(numReplicas);
+    for (size_t replicaIndex = 0; replicaIndex < numReplicas; replicaIndex++) {
+      const size_t replicaSeed{chainIndex + replicaIndex * numChains}; // Same as the chain index for the recording replica.
+      ExtendedPcg32<> otherRandom{std::seed_seq{replicaSeed, 0x3D6411FFUL, 0xDE44B7D2UL, seed, 0xE9F523E9UL, 0xD64CFEEEUL}};
+      size_t bootstrapIndex{0};
+      if (replicaIndex == 0) {
+        bootstrapIndex = static_cast<size_t>(bootstrap(otherRandom));
+        numBounces = bootstrapIndex % numBootstrapBounces + minBounces;
+      } else {
+        bootstrapIndex = static_cast<size_t>(bootstrapPerBounces[numBounces - minBounces](otherRandom)) * numBootstrapBounces + (numBounces - minBounces);
+      }
+      Replica &replica{replicas.emplace_back(Replica{
+        Random{PSMLTRandom{ExtendedPcg32<>{std::seed_seq{seed, 0xA7CBE565UL, 0x6AF93C73UL, bootstrapIndex, 0xE5C6FB2CUL, 0x24718FB5UL}}, mOptions.smallStepSigma, mOptions.largeStepProbability}}, //
+        otherRandom, std::nullopt, std::nullopt})};
+      replica.CCurr = doRandomSample(replica.random, numBounces);
+      if (!replica.CCurr) [[unlikely]] {
+        throw Error(std::logic_error("Bootstrap contribution should have been non-null!"));
+      }
     }
     for (size_t mutationIndex = 0; mutationIndex < numChainMutations; mutationIndex++) {
-      random.as<PSMLTRandom>().nextIteration();
-      double accept{0};
-      if (CNext = doRandomSample(random, numBounces)) accept = fmin(1.0, CNext->pathI / CCurr->pathI);
-      if (accept > 0) recorder(*CNext, overallValue / CNext->pathI * accept);
-      if (accept < 1) recorder(*CCurr, overallValue / CCurr->pathI * (1 - accept));
-      if (randomize<double>(otherRandom) < accept) {
-        CCurr = std::move(CNext);
-        random.as<PSMLTRandom>().finishAndAccept();
-      } else {
-        random.as<PSMLTRandom>().finishAndReject();
+      for (size_t replicaIndex = 0; replicaIndex < numReplicas; replicaIndex++) {
+        auto &[random, otherRandom, CCurr, CNext] = replicas[replicaIndex];
+        const double inverseTemperature{inverseTemperatures[replicaIndex]};
+        random.as<PSMLTRandom>().nextIteration();
+        double accept{0};
+        if (CNext = doRandomSample(random, numBounces)) accept = fmin(1.0, inverseTemperature == 1 ? CNext->pathI / CCurr->pathI : pow(CNext->pathI / CCurr->pathI, inverseTemperature));
+        if (replicaIndex == 0) {
+          if (accept > 0) {
+            double multiplier{overallValue / CNext->pathI * accept};
+            recorder(*CNext, multiplier);
+            statistics.contributionPerBounces[numBounces] += multiplier * CNext->pathI;
+          }
+          if (accept < 1) {
+            double multiplier{overallValue / CCurr->pathI * (1 - accept)};
+            recorder(*CCurr, multiplier);
+            statistics.contributionPerBounces[numBounces] += multiplier * CCurr->pathI;
+          }
+          statistics.numMutations++;
+        }
+        if (randomize<double>(otherRandom) < accept) {
+          CCurr = std::move(CNext);
+          random.as<PSMLTRandom>().finishAndAccept();
+          if (replicaIndex == 0) statistics.numAcceptedMutations++;
+        } else {
+          random.as<PSMLTRandom>().finishAndReject();
+        }
+      }
+      // Propose exchanges between neighboring replicas, alternating between the even and odd pairs. The exchange
+      // moves the states between the temperatures, and the acceptance probability is the ratio of the product of
+      // the tempered target densities after and before the exchange.
+      if (numReplicas > 1 && (mutationIndex + 1) % numMutationsPerExchange == 0) {
+        for (size_t replicaIndex = (mutationIndex / numMutationsPerExchange) % 2; replicaIndex + 1 < numReplicas; replicaIndex += 2) {
+          auto &replicaA{replicas[replicaIndex]};
+          auto &replicaB{replicas[replicaIndex + 1]};
+          double accept{pow(replicaB.CCurr->pathI / replicaA.CCurr->pathI, inverseTemperatures[replicaIndex] - inverseTemperatures[replicaIndex + 1])};
+          statistics.numExchanges++;
+          if (randomize<double>(replicas[0].otherRandom) < accept) {
+            std::swap(replicaA.random, replicaB.random);
+            std::swap(replicaA.CCurr, replicaB.CCurr);
+            statistics.numAcceptedExchanges++;
+          }
+        }
       }
-      progress.increment();
+      if (progress) progress->increment();
     }
   }
+
+  Statistics statistics;
+  statistics.contributionPerBounces.resize(maxBounces + 1);
+  for (const auto &each : threadStatistics) {
+    statistics.numMutations += each.numMutations;
+    statistics.numAcceptedMutations += each.numAcceptedMutations;
+    statistics.numExchanges += each.numExchanges;
+    statistics.numAcceptedExchanges += each.numAcceptedExchanges;
+    for (size_t i = 0; i <= maxBounces; i++) statistics.contributionPerBounces[i] += each.contributionPerBounces[i];
+  }
+  if (statistics.numMutations > 0)
+    for (double &value : statistics.contributionPerBounces) value /= statistics.numMutations;
+  return statistics;
+}
+
+PSMLTIntegrator::Statistics PSMLTIntegrator::operator()(const RandomSampler &randomSampler, SpectrumImage &image) const {
+  const size_t numBands{size_t(image.numBands())};
+  std::vector<SpectrumImageAccumulator> accumulators;
+  accumulators.reserve(omp_get_max_threads());
+  for (int threadIndex = 0; threadIndex < omp_get_max_threads(); threadIndex++) accumulators.emplace_back(image);
+  Statistics statistics{(*this)(randomSampler, [&](const Contribution &contribution, double multiplier) {
+    Vector2i index{int(floor(contribution.pixelCoordinate[0])), int(floor(contribution.pixelCoordinate[1]))};
+    if (!image.isIndexValid(index)) [[unlikely]]
+      return;
+    if (contribution.pathL.size() != numBands) [[unlikely]]
+      throw Error(std::logic_error("Call to PSMLTIntegrator::operator()() failed! Reason: Inconsistent bands"));
+    accumulators[omp_get_thread_num()].add(index, contribution.pathL * multiplier);
+  })};
+#pragma omp parallel for schedule(static, 1)
+  for (ptrdiff_t threadIndex = 0; threadIndex < ptrdiff_t(accumulators.size()); threadIndex++) accumulators[threadIndex].merge();
+  return statistics;
 }
 
 } // namespace mi::render
@@ -53,84 +53,259 @@ std::optional<VolumeScattering> HomogeneousMedium::transmissionSample(Random &ra
   }
 }
 
-void HeterogeneousDeltaTrackingMedium::transmission(Random &random, Ray3d ray, Spectrum &tr) const {
-  if (auto params = mBoundBox.rayCast(ray)) {
-    // Restrict ray parameter range, normalize the ray, and declare distance tracking variables.
+MajorantGrid::MajorantGrid(BoundBox3d boundBox, Vector3i count, std::vector<double> majorants) : mBoundBox(boundBox), mCount(count), mMajorants(std::move(majorants)) {
+  if (!allTrue(mCount > 0) || mMajorants.size() != size_t(mCount.product())) [[unlikely]]
+    throw Error(std::invalid_argument("Call to MajorantGrid::MajorantGrid() failed! Reason: Inconsistent majorant count"));
+}
+
+MajorantGrid::MajorantGrid(BoundBox3d boundBox, Vector3i count, const std::function<double(Vector3d point)> &sigmaT, int numSamplesPerAxis, double safetyFactor)
+  : mBoundBox(boundBox), mCount(count), mMajorants(size_t(count.product()), 0.0) {
+  if (!allTrue(mCount > 0)) [[unlikely]]
+    throw Error(std::invalid_argument("Call to MajorantGrid::MajorantGrid() failed! Reason: Non-positive count"));
+  numSamplesPerAxis = max(numSamplesPerAxis, 2);
+  Vector3d cellSize{mBoundBox.extent() / Vector3d(mCount)};
+  for (int z = 0; z < mCount[2]; z++) {
+    for (int y = 0; y < mCount[1]; y++) {
+      for (int x = 0; x < mCount[0]; x++) {
+        Vector3d cellLower{mBoundBox.lower() + cellSize * Vector3d(x, y, z)};
+        double value{0};
+        for (int k = 0; k < numSamplesPerAxis; k++)
+          for (int j = 0; j < numSamplesPerAxis; j++)
+            for (int i = 0; i < numSamplesPerAxis; i++) value = max(value, sigmaT(cellLower + cellSize * Vector3d(i, j, k) / double(numSamplesPerAxis - 1)));
+        mMajorants[(size_t(z) * size_t(mCount[1]) + size_t(y)) * size_t(mCount[0]) + size_t(x)] = value * safetyFactor;
+      }
+    }
+  }
+}
+
+HeterogeneousDeltaTrackingMedium::HeterogeneousDeltaTrackingMedium(BoundBox3d boundBox, Vector3i count, size_t numBands, SigmaProvider sigmaProvider, ScatteringProvider scatteringProvider)
+  : mSigmaProvider(std::move(sigmaProvider)), mScatteringProvider(std::move(scatteringProvider)) {
+  Spectrum sigmaS{with_shape, numBands};
+  Spectrum sigmaA{with_shape, numBands};
+  mMajorantGrid = MajorantGrid(boundBox, count, [&](Vector3d point) {
+    // The extinction may in general depend on direction, so take the maximum over the axis directions.
+    double value{0};
+    for (Vector3d omega : {Vector3d(1, 0, 0), Vector3d(0, 1, 0), Vector3d(0, 0, 1), Vector3d(-1, 0, 0), Vector3d(0, -1, 0), Vector3d(0, 0, -1)}) {
+      mSigmaProvider(point, omega, sigmaS, sigmaA);
+      for (size_t i = 0; i < numBands; i++) value = max(value, sigmaS[i] + sigmaA[i]);
+    }
+    return value;
+  });
+}
+
+/// Calculate transmission with ratio tracking through the majorant grid. The sigma function must fill in the
+/// scattering and absorption coefficients at the given point.
+template <typename SigmaFunc> static void ratioTracking(const MajorantGrid &majorantGrid, Random &random, Ray3d ray, Spectrum &tr, SigmaFunc &&sigmaFunc) {
+  if (auto params = majorantGrid.boundBox().rayCast(ray)) {
+    // Restrict ray parameter range and normalize the ray.
     ray.minParam = max(ray.minParam, params->first);
     ray.maxParam = min(ray.maxParam, params->second);
     ray = normalize(ray);
-    double hitDistance{0};
-    double maxDistance{ray.maxParam};
 
     // Allocate spectra for the volume coefficients.
     Spectrum sigmaS{spectrumZerosLike(tr)};
     Spectrum sigmaA{spectrumZerosLike(tr)};
-    double invMaxSigmaT{1 / mMaxSigmaT};
 
     // Calculate transmission with ratio tracking. Essentially what we're doing is randomly sampling events
     // according to our majorant extinction, then accumulating the probability of null-scattering at each
-    // event.
-    while (true) {
-      if (hitDistance += -log1p(-random.generate1()) * invMaxSigmaT; hitDistance < maxDistance) {
-        mSigmaProvider(ray(hitDistance), -ray.direction, sigmaS, sigmaA);
-        DoesntAlias(tr) *= 1 - (sigmaS + sigmaA) * invMaxSigmaT;
-      } else {
-        break;
+    // event. We do this separately in each cell of the majorant grid, which is valid because the exponential
+    // distribution is memoryless, so we can always restart at the cell boundary.
+    majorantGrid.traverse(ray, [&](double hitDistance, double maxDistance, double maxSigmaT) {
+      if (!(maxSigmaT > 0)) return true; // Nothing to track in empty cells.
+      double invMaxSigmaT{1 / maxSigmaT};
+      while (true) {
+        if (hitDistance += -log1p(-random.generate1()) * invMaxSigmaT; hitDistance < maxDistance) {
+          sigmaFunc(ray(hitDistance), -ray.direction, sigmaS, sigmaA);
+          DoesntAlias(tr) *= 1 - (sigmaS + sigmaA) * invMaxSigmaT;
+        } else {
+          break;
+        }
       }
-    }
+      return true;
+    });
   }
 }
 
-std::optional<VolumeScattering> HeterogeneousDeltaTrackingMedium::transmissionSample(Random &random, Ray3d ray, Spectrum &ratio) const {
-  if (auto params = mBoundBox.rayCast(ray)) {
-    // Restrict ray parameter range, normalize the ray, and declare distance tracking variables.
+/// Calculate transmission sample with delta tracking through the majorant grid. The sigma function must fill in the
+/// scattering and absorption coefficients at the given point.
+template <typename SigmaFunc>
+[[nodiscard]] static std::optional<VolumeScattering> deltaTracking(
+  const MajorantGrid &majorantGrid, Random &random, Ray3d ray, Spectrum &ratio, SigmaFunc &&sigmaFunc, const std::function<Scattering(Vector3d point)> &scatteringProvider) {
+  std::optional<VolumeScattering> result;
+  if (auto params = majorantGrid.boundBox().rayCast(ray)) {
+    // Restrict ray parameter range and normalize the ray.
     ray.minParam = max(ray.minParam, params->first);
     ray.maxParam = min(ray.maxParam, params->second);
     ray = normalize(ray);
-    double hitDistance{0};
-    double maxDistance{ray.maxParam};
 
     // Allocate spectra for the volume coefficients.
     Spectrum sigmaS{spectrumZerosLike(ratio)};
     Spectrum sigmaA{spectrumZerosLike(ratio)};
-    double invMaxSigmaT{1 / mMaxSigmaT};
-
-    // Calculate transmission sample with delta tracking. Note that the calculation here is fully
-    // spectral (unlike, e.g., PBRT which assumes total extinction is wavelength independent), so
-    // we do not see as much term cancellation as other implementations. Moreover, the code is
-    // intentionally left unsimplified because reducing the terms makes it way less obvious what
-    // is actually happening.
-    while (true) {
-      if (hitDistance += -log1p(-random.generate1()) * invMaxSigmaT; hitDistance < maxDistance) {
-        mSigmaProvider(ray(hitDistance), -ray.direction, sigmaS, sigmaA);
-        Spectrum sigmaN = mMaxSigmaT - (sigmaS + sigmaA); // Null scattering coefficient.
-        Spectrum probN = sigmaN * invMaxSigmaT;           // Null scattering probability.
-
-        if (auto i{random.generateIndex(probN.size())}; random.generate1() < 1 - probN[i]) {
-          // We intersected in the medium, so update the ratio accordingly. Note that there are some "invisible"
-          // or implicitly cancelled terms in the right hand side. We're really multiplying by the transmission over
-          // the probability of sampling the distance, and further dividing out the probability of scattering versus
-          // null-scattering.
-          DoesntAlias(ratio) *= sigmaS * invMaxSigmaT / stats::mean(1 - probN);
-
-          VolumeScattering volumeScattering;
-          volumeScattering.position = ray(hitDistance);
-          if (mScatteringProvider) volumeScattering.scattering = mScatteringProvider(volumeScattering.position);
-          return volumeScattering;
+
+    // Calculate transmission sample with delta tracking, separately in each cell of the majorant grid. Note that
+    // the calculation here is fully spectral (unlike, e.g., PBRT which assumes total extinction is wavelength
+    // independent), so we do not see as much term cancellation as other implementations. Moreover, the code is
+    // intentionally left unsimplified because reducing the terms makes it way less obvious what is actually
+    // happening.
+    majorantGrid.traverse(ray, [&](double hitDistance, double maxDistance, double maxSigmaT) {
+      if (!(maxSigmaT > 0)) return true; // Nothing to track in empty cells.
+      double invMaxSigmaT{1 / maxSigmaT};
+      while (true) {
+        if (hitDistance += -log1p(-random.generate1()) * invMaxSigmaT; hitDistance < maxDistance) {
+          sigmaFunc(ray(hitDistance), -ray.direction, sigmaS, sigmaA);
+          Spectrum sigmaN = maxSigmaT - (sigmaS + sigmaA); // Null scattering coefficient.
+          Spectrum probN = sigmaN * invMaxSigmaT;          // Null scattering probability.
+
+          if (auto i{random.generateIndex(probN.size())}; random.generate1() < 1 - probN[i]) {
+            // We intersected in the medium, so update the ratio accordingly. Note that there are some "invisible"
+            // or implicitly cancelled terms in the right hand side. We're really multiplying by the transmission over
+            // the probability of sampling the distance, and further dividing out the probability of scattering versus
+            // null-scattering.
+            DoesntAlias(ratio) *= sigmaS * invMaxSigmaT / stats::mean(1 - probN);
+
+            VolumeScattering &volumeScattering{result.emplace()};
+            volumeScattering.position = ray(hitDistance);
+            if (scatteringProvider) volumeScattering.scattering = scatteringProvider(volumeScattering.position);
+            return false;
+          } else {
+            // It is important to remark that null scattering is still "scattering" as far as the math
+            // is concerned, so we have to update the ratio in the same way as the scattering case,
+            // except with sigmaN instead of sigmaS. However, in non-spectral implementations like PBRT,
+            // the numerator and denominator work out to be equivalent, so they simply ignore null-scattering
+            // ratio updates.
+            DoesntAlias(ratio) *= sigmaN * invMaxSigmaT / stats::mean(probN);
+          }
+        } else {
+          break;
+        }
+      }
+      return true;
+    });
+  }
+  return result;
+}
+
+void HeterogeneousDeltaTrackingMedium::transmission(Random &random, Ray3d ray, Spectrum &tr) const { ratioTracking(mMajorantGrid, random, ray, tr, mSigmaProvider); }
+
+std::optional<VolumeScattering> HeterogeneousDeltaTrackingMedium::transmissionSample(Random &random, Ray3d ray, Spectrum &ratio) const {
+  return deltaTracking(mMajorantGrid, random, ray, ratio, mSigmaProvider, mScatteringProvider);
+}
+
+VoxelGridMedium::VoxelGridMedium(
+  BoundBox3d boundBox, Vector3i count, const std::vector<float> &densities, Spectrum sigmaS, Spectrum sigmaA, ScatteringProvider scatteringProvider, const Options &options)
+  : mBoundBox(boundBox),                                    //
+    mCount(count),                                          //
+    mBrickCount((count + (BrickSize - 1)) / BrickSize),     //
+    mSparse(options.sparse),                                //
+    mHalfPrecision(options.halfPrecision),                  //
+    mStochasticLookup(options.stochasticLookup),            //
+    mSigmaS(std::move(sigmaS)),                             //
+    mSigmaT(mSigmaS + std::move(sigmaA)),                   //
+    mScatteringProvider(std::move(scatteringProvider)) {
+  if (!allTrue(mCount > 0) || densities.size() != size_t(mCount.product())) [[unlikely]]
+    throw Error(std::invalid_argument("Call to VoxelGridMedium::VoxelGridMedium() failed! Reason: Inconsistent density count"));
+  auto densityAt = [&](Vector3i index) -> float {
+    if (!allTrue(0 <= index && index < mCount)) return 0;
+    float value{densities[(size_t(index[2]) * size_t(mCount[1]) + size_t(index[1])) * size_t(mCount[0]) + size_t(index[0])]};
+    return mHalfPrecision ? float(Half(value)) : value; // Round first if necessary, so the majorants bound the stored values.
+  };
+
+  // Build the bricks and the majorants. Since trilinear interpolation blends with the neighboring voxels, the
+  // majorant for each brick must account for the one-voxel border around it.
+  const size_t numBricks{size_t(mBrickCount.product())};
+  const size_t numBrickValues{size_t(BrickSize * BrickSize * BrickSize)};
+  const double maxSigmaT{mSigmaT.fold([](double a, double b) { return max(a, b); })};
+  std::vector<double> majorants(numBricks, 0.0);
+  mBrickIndexes.resize(numBricks, EmptyBrick);
+  std::vector<float> brickValues(numBrickValues);
+  uint32_t numStoredBricks{0};
+  for (int brickZ = 0; brickZ < mBrickCount[2]; brickZ++) {
+    for (int brickY = 0; brickY < mBrickCount[1]; brickY++) {
+      for (int brickX = 0; brickX < mBrickCount[0]; brickX++) {
+        const Vector3i brickLower{Vector3i(brickX, brickY, brickZ) * BrickSize};
+        const size_t brickIndex{(size_t(brickZ) * size_t(mBrickCount[1]) + size_t(brickY)) * size_t(mBrickCount[0]) + size_t(brickX)};
+        float maxDensity{0};
+        for (int z = -1; z <= BrickSize; z++)
+          for (int y = -1; y <= BrickSize; y++)
+            for (int x = -1; x <= BrickSize; x++) maxDensity = max(maxDensity, densityAt(brickLower + Vector3i(x, y, z)));
+        majorants[brickIndex] = maxDensity * maxSigmaT;
+        bool isEmpty{true};
+        for (int z = 0, i = 0; z < BrickSize; z++) {
+          for (int y = 0; y < BrickSize; y++) {
+            for (int x = 0; x < BrickSize; x++, i++) {
+              brickValues[i] = densityAt(brickLower + Vector3i(x, y, z));
+              isEmpty = isEmpty && brickValues[i] == 0;
+            }
+          }
+        }
+        if (isEmpty && mSparse) continue;
+        mBrickIndexes[brickIndex] = numStoredBricks++;
+        if (mHalfPrecision) {
+          for (float value : brickValues) mHalfValues.emplace_back(value);
         } else {
-          // It is important to remark that null scattering is still "scattering" as far as the math
-          // is concerned, so we have to update the ratio in the same way as the scattering case,
-          // except with sigmaN instead of sigmaS. However, in non-spectral implementations like PBRT,
-          // the numerator and denominator work out to be equivalent, so they simply ignore null-scattering
-          // ratio updates.
-          DoesntAlias(ratio) *= sigmaN * invMaxSigmaT / stats::mean(probN);
+          mFloatValues.insert(mFloatValues.end(), brickValues.begin(), brickValues.end());
         }
-      } else {
-        break;
       }
     }
   }
-  return {};
+
+  // The majorant grid covers whole bricks, which may extend past the bounding box of the voxels.
+  Vector3d voxelSize{mBoundBox.extent() / Vector3d(mCount)};
+  mMajorantGrid = MajorantGrid(BoundBox3d(mBoundBox.lower(), mBoundBox.lower() + voxelSize * Vector3d(mBrickCount * BrickSize)), mBrickCount, std::move(majorants));
+}
+
+VoxelGridMedium::VoxelGridMedium(BoundBox3d boundBox, Vector3i count, const std::vector<float> &densities, Spectrum sigmaS, Spectrum sigmaA, ScatteringProvider scatteringProvider)
+  : VoxelGridMedium(boundBox, count, densities, std::move(sigmaS), std::move(sigmaA), std::move(scatteringProvider), Options()) {}
+
+float VoxelGridMedium::voxel(Vector3i index) const noexcept {
+  if (!allTrue(0 <= index && index < mCount)) return 0;
+  const Vector3i brick{index / BrickSize};
+  const Vector3i local{index - brick * BrickSize};
+  const uint32_t brickIndex{mBrickIndexes[(size_t(brick[2]) * size_t(mBrickCount[1]) + size_t(brick[1])) * size_t(mBrickCount[0]) + size_t(brick[0])]};
+  if (brickIndex == EmptyBrick) return 0;
+  const size_t valueIndex{size_t(brickIndex) * size_t(BrickSize * BrickSize * BrickSize) + size_t((local[2] * BrickSize + local[1]) * BrickSize + local[0])};
+  return mHalfPrecision ? float(mHalfValues[valueIndex]) : mFloatValues[valueIndex];
+}
+
+double VoxelGridMedium::density(Vector3d point) const noexcept {
+  Vector3d position{(point - mBoundBox.lower()) / mBoundBox.extent() * Vector3d(mCount) - 0.5};
+  Vector3d positionFloor{floor(position)};
+  Vector3d fraction{position - positionFloor};
+  Vector3i index{positionFloor};
+  double value{0};
+  for (int corner = 0; corner < 8; corner++) {
+    Vector3i offset{corner & 1, (corner >> 1) & 1, (corner >> 2) & 1};
+    double weight{1};
+    for (size_t k = 0; k < 3; k++) weight *= offset[k] ? fraction[k] : 1 - fraction[k];
+    if (weight > 0) value += weight * voxel(index + offset);
+  }
+  return value;
+}
+
+double VoxelGridMedium::density(Vector3d point, Random &random) const noexcept {
+  // Jittering by a uniform offset and rounding down selects each corner with probability equal to its trilinear
+  // weight, so the expected value is exactly the trilinear interpolant.
+  Vector3d position{(point - mBoundBox.lower()) / mBoundBox.extent() * Vector3d(mCount) - 0.5 + random.generate3()};
+  return voxel(Vector3i(floor(position)));
+}
+
+void VoxelGridMedium::transmission(Random &random, Ray3d ray, Spectrum &tr) const {
+  ratioTracking(mMajorantGrid, random, ray, tr, [&](Vector3d point, Vector3d, Spectrum &sigmaS, Spectrum &sigmaA) {
+    double value{mStochasticLookup ? density(point, random) : density(point)};
+    sigmaS = mSigmaS * value;
+    sigmaA = (mSigmaT - mSigmaS) * value;
+  });
+}
+
+std::optional<VolumeScattering> VoxelGridMedium::transmissionSample(Random &random, Ray3d ray, Spectrum &ratio) const {
+  return deltaTracking(
+    mMajorantGrid, random, ray, ratio,
+    [&](Vector3d point, Vector3d, Spectrum &sigmaS, Spectrum &sigmaA) {
+      double value{mStochasticLookup ? density(point, random) : density(point)};
+      sigmaS = mSigmaS * value;
+      sigmaA = (mSigmaT - mSigmaS) * value;
+    },
+    mScatteringProvider);
 }
 
 } // namespace mi::render
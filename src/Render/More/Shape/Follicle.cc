@@ -5,15 +5,16 @@ namespace mi::render {
 
 BoundBox3d Follicle::box() const noexcept {
   BoundBox3d boundBox{curve};
-  boundBox[0] -= 0.5 * max(radiusA, radiusB);
-  boundBox[1] += 0.5 * max(radiusA, radiusB);
+  boundBox[0] -= max(radiusA, radiusB);
+  boundBox[1] += max(radiusA, radiusB);
   return boundBox;
 }
 
 std::optional<double> Follicle::intersect(Ray3d ray, Manifold &manifold) const noexcept {
   double dirLength{fastLength(ray.direction)};
   Vector3d up{Matrix3d::orthonormalBasisDiscontinuous(ray.direction / dirLength).col(1)};
-  DualQuaterniond localToWorld{DualQuaterniond::lookAt(ray.origin, ray.origin + ray.direction, up)};
+  // Note: The look-at transform looks down the negative Z-axis, so look away from the ray to put it on the positive Z-axis.
+  DualQuaterniond localToWorld{DualQuaterniond::lookAt(ray.origin, ray.origin - ray.direction, up)};
   DualQuaterniond worldToLocal{inverse(localToWorld)};
   Follicle follicle{*this};
   follicle >>= worldToLocal;
@@ -34,7 +35,7 @@ std::optional<double> Follicle::intersectWithZAxis(double minParam, double maxPa
   auto nearXY{Bezier2d<3>(curve).nearestTo(Vector2d(0, 0))};
   auto normal{kind == Kind::Ribbon ? normalize(lerp(nearXY.param, normalA, normalB)) : Vector3d(0, 0, 1)};
   auto radius{lerp(nearXY.param, radiusA, radiusB) * abs(normal[2])};
-  if (!(fastLength(nearXY.point) < radius)) return false;
+  if (!(fastLength(nearXY.point) < radius)) return {};
 
   Vector3d nearPoint{curve(nearXY.param)};
   Vector3d nearDeriv{curve.derivative()(nearXY.param)};
@@ -0,0 +1,178 @@
+#include "Microcosm/Render/More/Shape/FollicleMesh"
+
+namespace mi::render {
+
+FollicleMesh::FollicleMesh(Kind kind, std::vector<Vector3f> controlPoints, std::vector<Vector2f> radii, std::vector<Vector3f> normals, const Options &options)
+  : mKind(kind), mControlPoints(std::move(controlPoints)), mRadii(std::move(radii)), mNormals(std::move(normals)) {
+  const size_t numCurves{mRadii.size()};
+  if (mControlPoints.size() != 4 * numCurves) [[unlikely]]
+    throw Error(std::invalid_argument("Call to FollicleMesh() failed! Reason: Expected 4 control points per curve"));
+  if (kind == Kind::Ribbon && mNormals.size() != 2 * numCurves) [[unlikely]]
+    throw Error(std::invalid_argument("Call to FollicleMesh() failed! Reason: Expected 2 normals per curve for ribbons"));
+  if (kind != Kind::Ribbon) mNormals.clear();
+  if (numCurves == 0) return;
+
+  // Subdivide every curve. The distance between a cubic and the chord of a segment of parameter length h is at most
+  // h^2/8 times the maximum magnitude of the second derivative, which is attained at one of its control points.
+  std::vector<Segment> segments;
+  segments.reserve(numCurves * max(options.numSegments, 1));
+  for (size_t curveIndex = 0; curveIndex < numCurves; curveIndex++) {
+    int numSegments{options.numSegments};
+    if (numSegments <= 0) {
+      const Vector3f *points{&mControlPoints[4 * curveIndex]};
+      double maxDeriv2{6 * max(length(Vector3d(points[0] - 2 * points[1] + points[2])), length(Vector3d(points[1] - 2 * points[2] + points[3])))};
+      double tolerance{options.flatness * max(mRadii[curveIndex][0], mRadii[curveIndex][1])};
+      numSegments = tolerance > 0 ? int(std::ceil(sqrt(maxDeriv2 / (8 * tolerance)))) : options.maxSegments;
+    }
+    numSegments = std::clamp(numSegments, 1, max(options.maxSegments, 1));
+    for (int k = 0; k < numSegments; k++) segments.push_back({uint32_t(curveIndex), {float(k) / numSegments, float(k + 1) / numSegments}});
+  }
+  geometry::ImmutableBVH3::Items items;
+  items.reserve(segments.size());
+  for (size_t i = 0; i < segments.size(); i++) {
+    Follicle follicle{segmentFollicle(segments[i])};
+    BoundBox3d box{follicle.curve};
+    box[0] -= max(follicle.radiusA, follicle.radiusB);
+    box[1] += max(follicle.radiusA, follicle.radiusB);
+    auto &item = items.emplace_back();
+    item.index = i;
+    item.box = BoundBox3f(box);
+    item.box[0] = item.box[0] - 1e-5f * abs(item.box[0]);
+    item.box[1] = item.box[1] + 1e-5f * abs(item.box[1]);
+    item.boxCenter = item.box.center();
+    mBox |= box;
+  }
+  auto buildOptions{options.buildOptions};
+  buildOptions.leafLimit = std::clamp<int>(buildOptions.leafLimit, 1, 255);
+  buildOptions.spatialSplits = false;
+  mSegmentBVH.build(buildOptions, items);
+  mSegments.reserve(items.size());
+  for (auto &item : items) mSegments.push_back(segments[item.index]);
+}
+
+FollicleMesh::FollicleMesh(const std::vector<Follicle> &follicles, const Options &options) {
+  std::vector<Vector3f> controlPoints;
+  std::vector<Vector2f> radii;
+  std::vector<Vector3f> normals;
+  controlPoints.reserve(4 * follicles.size());
+  radii.reserve(follicles.size());
+  normals.reserve(2 * follicles.size());
+  for (const auto &follicle : follicles) {
+    if (follicle.kind != follicles[0].kind) [[unlikely]]
+      throw Error(std::invalid_argument("Call to FollicleMesh() failed! Reason: Follicles must all be of the same kind"));
+    for (const auto &point : follicle.curve) controlPoints.emplace_back(point);
+    radii.emplace_back(follicle.radiusA, follicle.radiusB);
+    normals.emplace_back(follicle.normalA);
+    normals.emplace_back(follicle.normalB);
+  }
+  *this = FollicleMesh(follicles.empty() ? Kind() : follicles[0].kind, std::move(controlPoints), std::move(radii), std::move(normals), options);
+}
+
+Follicle FollicleMesh::follicle(size_t curveIndex) const noexcept {
+  Follicle result;
+  result.kind = mKind;
+  result.radiusA = mRadii[curveIndex][0];
+  result.radiusB = mRadii[curveIndex][1];
+  if (!mNormals.empty()) {
+    result.normalA = Vector3d(mNormals[2 * curveIndex + 0]);
+    result.normalB = Vector3d(mNormals[2 * curveIndex + 1]);
+  }
+  result.curve = Bezier3d<3>(&mControlPoints[4 * curveIndex]);
+  return result;
+}
+
+Follicle FollicleMesh::segmentFollicle(const Segment &segment) const noexcept {
+  Follicle result{follicle(segment.curveIndex)};
+  const double param0{segment.params[0]};
+  const double param1{segment.params[1]};
+  result.curve = result.curve.subsetBefore(param1).subsetAfter(param0 / param1);
+  std::tie(result.radiusA, result.radiusB) = std::pair{lerp(param0, result.radiusA, result.radiusB), lerp(param1, result.radiusA, result.radiusB)};
+  std::tie(result.normalA, result.normalB) = std::pair{lerp(param0, result.normalA, result.normalB), lerp(param1, result.normalA, result.normalB)};
+  return result;
+}
+
+std::optional<double> FollicleMesh::intersect(Ray3d ray, Manifold &manifold) const noexcept {
+  if (mSegments.empty()) return {};
+  // Set up the ray frame once for all segments, exactly as Follicle::intersect() does for one curve.
+  double dirLength{fastLength(ray.direction)};
+  Vector3d up{Matrix3d::orthonormalBasisDiscontinuous(ray.direction / dirLength).col(1)};
+  DualQuaterniond localToWorld{DualQuaterniond::lookAt(ray.origin, ray.origin - ray.direction, up)};
+  DualQuaterniond worldToLocal{inverse(localToWorld)};
+  double minParam{dirLength * ray.minParam};
+  double maxParam{dirLength * ray.maxParam};
+  const Segment *bestSegment{nullptr};
+  mSegmentBVH.visitRayCast(ray, [&](const geometry::ImmutableBVH3::Node &node) {
+    for (uint32_t i = node.first; i < node.first + node.count; i++) {
+      Follicle follicle{segmentFollicle(mSegments[i])};
+      follicle >>= worldToLocal;
+      if (auto param = follicle.intersectWithZAxis(minParam, maxParam, manifold)) {
+        maxParam = *param, ray.maxParam = *param / dirLength;
+        bestSegment = &mSegments[i];
+      }
+    }
+    return true;
+  });
+  if (!bestSegment) return {};
+  // Map the segment parameter back onto the whole curve.
+  const double param0{bestSegment->params[0]};
+  const double param1{bestSegment->params[1]};
+  manifold >>= localToWorld;
+  manifold.primitiveIndex = bestSegment->curveIndex;
+  manifold.correct.parameters[0] = lerp(manifold.correct.parameters[0], param0, param1);
+  manifold.correct.tangents[0] /= param1 - param0;
+  manifold.shading = manifold.correct;
+  return maxParam / dirLength;
+}
+
+std::optional<double> FollicleMesh::nearestTo(Vector3d referencePoint, Manifold &manifold) const noexcept {
+  auto todo{GrowableMinHeap<std::pair<double, const geometry::ImmutableBVH3::Node *>, 64>{}};
+  auto boxDistance = [&](const geometry::ImmutableBVH3::Node *node) { return distance(referencePoint, BoundBox3d(node->box).clamp(referencePoint)); };
+  auto dist{manifold.nearestDistance};
+  const Segment *bestSegment{nullptr};
+  double bestParam{0};
+  if (!mSegmentBVH.nodes.empty()) {
+    auto root{&mSegmentBVH.nodes[0]};
+    auto rootDist{boxDistance(root)};
+    if (rootDist < dist) todo.push({rootDist, root});
+  }
+  while (!todo.empty()) {
+    auto [nodeDist, node] = todo.pop();
+    if (!(nodeDist < dist)) continue;
+    if (node->isBranch()) {
+      for (auto child : {node + 1, node + node->right}) {
+        auto childDist{boxDistance(child)};
+        if (childDist < dist) todo.push({childDist, child});
+      }
+    } else {
+      for (uint32_t i = node->first; i < node->first + node->count; i++) {
+        Follicle follicle{segmentFollicle(mSegments[i])};
+        auto nearest{follicle.curve.nearestTo(referencePoint)};
+        double thisDist{abs(distance(referencePoint, nearest.point) - lerp(nearest.param, follicle.radiusA, follicle.radiusB))};
+        if (thisDist < dist) {
+          dist = thisDist;
+          bestSegment = &mSegments[i];
+          bestParam = lerp(nearest.param, double(mSegments[i].params[0]), double(mSegments[i].params[1]));
+        }
+      }
+    }
+  }
+  if (!bestSegment) return {};
+  Follicle follicle{this->follicle(bestSegment->curveIndex)};
+  Vector3d center{follicle.curve(bestParam)};
+  Vector3d deriv{follicle.curve.derivative()(bestParam)};
+  // Note: This is perpendicular to the curve except at the endpoints, where the tube is effectively capped.
+  Vector3d normal{referencePoint - center};
+  normal = lengthSquare(normal) > 0 ? normalize(normal) : Matrix3d::orthonormalBasisDiscontinuous(normalize(deriv)).col(0);
+  double radius{lerp(bestParam, follicle.radiusA, follicle.radiusB)};
+  manifold.point = center + radius * normal;
+  manifold.primitiveIndex = bestSegment->curveIndex;
+  manifold.correct.parameters = {bestParam, 0.5};
+  manifold.correct.tangents[0] = deriv;
+  manifold.correct.tangents[1] = normalize(cross(normal, deriv)) * radius;
+  manifold.correct.normal = normal;
+  manifold.shading = manifold.correct;
+  manifold.nearestDistance = dist;
+  return dist;
+}
+
+} // namespace mi::render
@@ -44,7 +44,7 @@ std::optional<double> Triangle::nearestTo(Vector3d referencePoint, Manifold &man
   // then we can quit immediately.
   Vector3d normal{cross(mPoints[1] - mPoints[0], mPoints[2] - mPoints[0])};
   Vector3d projector{1.0 / dot(normal, normal) * normal};
-  Vector3d projectee{referencePoint - dot(projector, referencePoint) * normal};
+  Vector3d projectee{referencePoint - dot(projector, referencePoint - mPoints[0]) * normal};
   double bestDist{manifold.nearestDistance};
   double thisDist{distance(referencePoint, projectee)};
   if (!(isfinite(thisDist) && thisDist < bestDist)) {
@@ -71,6 +71,7 @@ std::optional<double> Triangle::nearestTo(Vector3d referencePoint, Manifold &man
     } else {
       // If any barycentric coordinate is negative, the projectee is outside the interior region
       // of the triangle. Loop around the perimeter to find the closest point on an edge or vertex.
+      thisDist = constants::Inf<double>;
       for (size_t i = 0; i < 3; i++) {
         Vector3d pointA{mPoints[i]};
         Vector3d pointB{mPoints[(i + 1) % 3]};
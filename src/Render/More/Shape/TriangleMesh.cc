@@ -1,5 +1,4 @@
 #include "Microcosm/Render/More/Shape/TriangleMesh"
-#include "Microcosm/Render/More/Shape/Triangle"
 
 #if MI_BUILT_WITH_ASSIMP
 #include "assimp/Importer.hpp"
@@ -9,75 +8,290 @@
 
 namespace mi::render {
 
-void TriangleMesh::clear() noexcept { *this = TriangleMesh(); }
+namespace {
+
+/// Encode a unit vector with the octahedral encoding, with 16 bits per coordinate.
+uint32_t encodeOctahedral(Vector3d vectorV) noexcept {
+  vectorV /= abs(vectorV[0]) + abs(vectorV[1]) + abs(vectorV[2]);
+  Vector2d coords{vectorV[0], vectorV[1]};
+  if (vectorV[2] < 0) {
+    coords[0] = (1 - abs(vectorV[1])) * (vectorV[0] >= 0 ? 1 : -1);
+    coords[1] = (1 - abs(vectorV[0])) * (vectorV[1] >= 0 ? 1 : -1);
+  }
+  auto quantize = [](double coord) { return uint32_t(std::lround((std::clamp(coord, -1.0, 1.0) * 0.5 + 0.5) * 65535.0)); };
+  return quantize(coords[0]) | (quantize(coords[1]) << 16);
+}
+
+/// Decode a unit vector from the octahedral encoding.
+Vector3d decodeOctahedral(uint32_t value) noexcept {
+  Vector3d vectorV{(value & 0xFFFF) / 65535.0 * 2 - 1, (value >> 16) / 65535.0 * 2 - 1, 0};
+  vectorV[2] = 1 - abs(vectorV[0]) - abs(vectorV[1]);
+  if (vectorV[2] < 0) {
+    double coord0{vectorV[0]};
+    vectorV[0] = (1 - abs(vectorV[1])) * (coord0 >= 0 ? 1 : -1);
+    vectorV[1] = (1 - abs(coord0)) * (vectorV[1] >= 0 ? 1 : -1);
+  }
+  return normalize(vectorV);
+}
+
+/// The key for merging vertices, which is either the bits of all vertex attributes, or the attribute indexes.
+template <size_t N> struct VertexKey {
+  std::array<uint32_t, N> words{};
+  [[nodiscard]] bool operator==(const VertexKey &) const noexcept = default;
+};
+
+template <size_t N> struct VertexKeyHash {
+  [[nodiscard]] size_t operator()(const VertexKey<N> &key) const noexcept {
+    uint64_t hash{0xCBF29CE484222325ULL};
+    for (uint32_t word : key.words) hash = (hash ^ word) * 0x100000001B3ULL;
+    return size_t(hash ^ (hash >> 32));
+  }
+};
+
+/// Select the given rows of the values, in order.
+template <typename Values> void selectRows(Values &values, const std::vector<uint32_t> &rows) {
+  Values newValues{with_shape, rows.size()};
+  for (size_t k = 0; k < rows.size(); k++) newValues.row(k).assign(values.row(rows[k]));
+  values = std::move(newValues);
+}
+
+template <typename Value> void selectRows(std::vector<Value> &values, const std::vector<uint32_t> &rows, size_t width) {
+  std::vector<Value> newValues(rows.size() * width);
+  for (size_t k = 0; k < rows.size(); k++) std::copy_n(&values[width * rows[k]], width, &newValues[width * k]);
+  values = std::move(newValues);
+}
+
+} // namespace
+
+void TriangleMesh::clear() noexcept {
+  auto options{std::move(buildOptions)};
+  auto quantize{std::pair{quantizeNormals, quantizeTexcoords}};
+  *this = TriangleMesh();
+  buildOptions = std::move(options);
+  std::tie(quantizeNormals, quantizeTexcoords) = quantize;
+}
 
 void TriangleMesh::initialize() {
   if (positions.rows() == 0) {
     triangleBVH = {};
+    trianglePacks = {};
+    triangleWideBVH = {};
     return;
   }
   validate();
+  if (indexes.size() == 0) initializeIndexes();
   geometry::ImmutableBVH3::Items items;
   items.reserve(numTris());
   for (size_t i = 0; i < numTris(); i++) {
     auto &item = items.emplace_back();
     item.index = i;
-    item.box |= Vector3f(positions.row(3 * i + 0));
-    item.box |= Vector3f(positions.row(3 * i + 1));
-    item.box |= Vector3f(positions.row(3 * i + 2));
+    item.box |= Vector3f(positions.row(indexes[3 * i + 0]));
+    item.box |= Vector3f(positions.row(indexes[3 * i + 1]));
+    item.box |= Vector3f(positions.row(indexes[3 * i + 2]));
     item.boxCenter = item.box.center();
   }
-  triangleBVH.build(4, items);
-  auto reorderPerFaceVertex = [&](auto &values) {
-    std::decay_t<decltype(values)> newValues{values.shape};
-    for (size_t i = 0; i < items.size(); i++) {
-      newValues.row(3 * i + 0).assign(values.row(3 * items[i].index + 0));
-      newValues.row(3 * i + 1).assign(values.row(3 * items[i].index + 1));
-      newValues.row(3 * i + 2).assign(values.row(3 * items[i].index + 2));
+  auto options{buildOptions};
+  options.leafLimit = std::clamp<int>(options.leafLimit, 1, TrianglePackWidth);
+  options.spatialSplits = false;
+  triangleBVH.build(options, items);
+  // Reorder the triangles to match the hierarchy, and then reorder the vertices by first use, which puts the vertices
+  // of nearby triangles near each other in memory. This also drops unused vertices.
+  Vector<uint32_t, Dynamic> newIndexes{with_shape, indexes.size()};
+  for (size_t i = 0; i < items.size(); i++)
+    for (size_t k = 0; k < 3; k++) newIndexes[3 * i + k] = indexes[3 * items[i].index + k];
+  indexes = std::move(newIndexes);
+  if (materials) {
+    Vector<int16_t, Dynamic> newMaterials{with_shape, materials->size()};
+    for (size_t i = 0; i < items.size(); i++) newMaterials[i] = (*materials)[items[i].index];
+    materials = std::move(newMaterials);
+  }
+  std::vector<uint32_t> newVertexIndexes(numVerts(), uint32_t(-1));
+  std::vector<uint32_t> oldVertexIndexes;
+  oldVertexIndexes.reserve(numVerts());
+  for (auto &index : indexes) {
+    if (newVertexIndexes[index] == uint32_t(-1)) {
+      newVertexIndexes[index] = oldVertexIndexes.size();
+      oldVertexIndexes.push_back(index);
     }
-    values = std::move(newValues);
-  };
-  auto reorderPerFace = [&](auto &values) {
-    std::decay_t<decltype(values)> newValues{values.shape};
-    for (size_t i = 0; i < items.size(); i++) newValues[i] = values[items[i].index];
-    values = std::move(newValues);
-  };
-  reorderPerFaceVertex(positions);
-  if (texcoords) reorderPerFaceVertex(*texcoords);
-  if (normals) reorderPerFaceVertex(*normals);
-  if (tangents) reorderPerFaceVertex(*tangents);
-  if (materials) reorderPerFace(*materials);
+    index = newVertexIndexes[index];
+  }
+  selectRows(positions, oldVertexIndexes);
+  if (texcoords) selectRows(*texcoords, oldVertexIndexes);
+  if (normals) selectRows(*normals, oldVertexIndexes);
+  if (tangents) selectRows(*tangents, oldVertexIndexes);
+  if (!quantizedTexcoords.empty()) selectRows(quantizedTexcoords, oldVertexIndexes, 2);
+  if (!quantizedNormals.empty()) selectRows(quantizedNormals, oldVertexIndexes, 1);
+  if (!quantizedTangents.empty()) selectRows(quantizedTangents, oldVertexIndexes, 1);
+  if (quantizeTexcoords && texcoords) {
+    quantizedTexcoords.resize(2 * numVerts());
+    for (size_t v = 0; v < numVerts(); v++) quantizedTexcoords[2 * v + 0] = Half((*texcoords)(v, 0)), quantizedTexcoords[2 * v + 1] = Half((*texcoords)(v, 1));
+    texcoords.reset();
+  }
+  if (quantizeNormals && normals) {
+    quantizedNormals.resize(numVerts());
+    for (size_t v = 0; v < numVerts(); v++) quantizedNormals[v] = encodeOctahedral(Vector3d(normals->row(v)));
+    normals.reset();
+  }
+  if (quantizeNormals && tangents) {
+    quantizedTangents.resize(numVerts());
+    for (size_t v = 0; v < numVerts(); v++) quantizedTangents[v] = encodeOctahedral(Vector3d(tangents->row(v)));
+    tangents.reset();
+  }
+  initializeTexcoordTangents();
+  if (!buildOptions.spatialSplits) {
+    initializePacks(triangleBVH, nullptr);
+  } else {
+    // The spatial split hierarchy references triangles more than once, so it cannot be the triangle bounding
+    // volume hierarchy, which must reference every triangle exactly once to keep nearestTo() and the triangle
+    // order simple. It only exists long enough to build the wide hierarchy and the triangle packs.
+    for (size_t i = 0; i < numTris(); i++) items[i].index = i;
+    options.spatialSplits = true;
+    options.clipper = [&](uint32_t i, const BoundBox3f &box) { return clipTriangle(i, box); };
+    geometry::ImmutableBVH3 spatialBVH;
+    spatialBVH.build(options, items);
+    initializePacks(spatialBVH, &items);
+  }
+}
+
+void TriangleMesh::initializeIndexes() {
+  // Merge vertices whose attributes are bitwise identical.
+  static constexpr size_t NumWords = 3 + 2 + 3 + 3;
+  const size_t numInputVerts{size_t(positions.rows())};
+  std::unordered_map<VertexKey<NumWords>, uint32_t, VertexKeyHash<NumWords>> vertexIndexes;
+  std::vector<uint32_t> oldVertexIndexes;
+  vertexIndexes.reserve(numInputVerts);
+  indexes = Vector<uint32_t, Dynamic>{with_shape, numInputVerts};
+  for (size_t v = 0; v < numInputVerts; v++) {
+    VertexKey<NumWords> key;
+    auto wordsOf = [&](const auto &row, size_t offset) {
+      for (size_t k = 0; k < row.size(); k++) key.words[offset + k] = std::bit_cast<uint32_t>(float(row[k]));
+    };
+    wordsOf(positions.row(v), 0);
+    if (texcoords) wordsOf(texcoords->row(v), 3);
+    if (normals) wordsOf(normals->row(v), 5);
+    if (tangents) wordsOf(tangents->row(v), 8);
+    auto [itr, inserted] = vertexIndexes.try_emplace(key, uint32_t(oldVertexIndexes.size()));
+    if (inserted) oldVertexIndexes.push_back(v);
+    indexes[v] = itr->second;
+  }
+  selectRows(positions, oldVertexIndexes);
+  if (texcoords) selectRows(*texcoords, oldVertexIndexes);
+  if (normals) selectRows(*normals, oldVertexIndexes);
+  if (tangents) selectRows(*tangents, oldVertexIndexes);
+}
+
+void TriangleMesh::initializeTexcoordTangents() {
+  texcoordTangents.reset();
+  if (!hasTexcoords() || hasTangents()) return;
+  texcoordTangents.emplace(with_shape, 2 * numTris());
+  for (size_t i = 0; i < numTris(); i++) {
+    // Solve the 2x2 system relating the edges in texture space to the edges in world space.
+    Vector2d texcoord0{vertexTexcoord(indexes[3 * i + 0])};
+    Vector2d texcoord1{vertexTexcoord(indexes[3 * i + 1])};
+    Vector2d texcoord2{vertexTexcoord(indexes[3 * i + 2])};
+    Vector3d point0{vertexPosition(indexes[3 * i + 0])};
+    Vector3d edge1{vertexPosition(indexes[3 * i + 1]) - point0};
+    Vector3d edge2{vertexPosition(indexes[3 * i + 2]) - point0};
+    Vector2d deltaUV1{texcoord1 - texcoord0};
+    Vector2d deltaUV2{texcoord2 - texcoord0};
+    double factor{1 / (deltaUV1[0] * deltaUV2[1] - deltaUV1[1] * deltaUV2[0])};
+    Vector3d tangent0{factor * (deltaUV2[1] * edge1 - deltaUV1[1] * edge2)};
+    Vector3d tangent1{factor * (deltaUV1[0] * edge2 - deltaUV2[0] * edge1)};
+    if (!(isfinite(factor) && lengthSquare(tangent0) < constants::Max<float> && lengthSquare(tangent1) < constants::Max<float>)) {
+      tangent0 = {};
+      tangent1 = {};
+    }
+    texcoordTangents->row(2 * i + 0).assign(tangent0);
+    texcoordTangents->row(2 * i + 1).assign(tangent1);
+  }
+}
+
+BoundBox3f TriangleMesh::clipTriangle(uint32_t i, const BoundBox3f &box) const noexcept {
+  // Sutherland-Hodgman, clipping the triangle polygon against each of the box planes in turn. Every plane
+  // can add at most one vertex, so 9 vertices is enough.
+  Vector3f points[9]{Vector3f(positions.row(indexes[3 * i + 0])), Vector3f(positions.row(indexes[3 * i + 1])), Vector3f(positions.row(indexes[3 * i + 2]))};
+  size_t numPoints{3};
+  for (size_t side = 0; side < 2; side++) {
+    for (size_t axis = 0; axis < 3; axis++) {
+      Vector3f clipped[9];
+      size_t numClipped{0};
+      float plane{box[side][axis]};
+      auto isInside = [&](const Vector3f &point) { return side == 0 ? point[axis] >= plane : point[axis] <= plane; };
+      for (size_t k = 0; k < numPoints; k++) {
+        const Vector3f &pointA{points[k]};
+        const Vector3f &pointB{points[(k + 1) % numPoints]};
+        bool insideA{isInside(pointA)};
+        bool insideB{isInside(pointB)};
+        if (insideA) clipped[numClipped++] = pointA;
+        if (insideA != insideB) {
+          Vector3f point{lerp((plane - pointA[axis]) / (pointB[axis] - pointA[axis]), pointA, pointB)};
+          point[axis] = plane;
+          clipped[numClipped++] = point;
+        }
+      }
+      std::copy(&clipped[0], &clipped[0] + numClipped, &points[0]);
+      if ((numPoints = numClipped) == 0) return {};
+    }
+  }
+  BoundBox3f result;
+  for (size_t k = 0; k < numPoints; k++) result |= points[k];
+  return result;
+}
+
+void TriangleMesh::initializePacks(const geometry::ImmutableBVH3 &bvh, const geometry::ImmutableBVH3::Items *items) {
+  trianglePacks.clear();
+  triangleWideBVH.build(bvh);
+  for (auto &node : triangleWideBVH.nodes) {
+    for (size_t k = 0; k < node.numChildren; k++) {
+      if (node.isBranch(k)) continue;
+      TrianglePack &pack{trianglePacks.emplace_back()};
+      for (size_t j = 0; j < node.count[k]; j++) {
+        uint32_t i = items ? (*items)[node.first[k] + j].index : node.first[k] + j;
+        for (size_t corner = 0; corner < 3; corner++) pack.vertexIndexes[corner][j] = indexes[3 * i + corner];
+        pack.index[j] = i;
+      }
+      node.first[k] = trianglePacks.size() - 1;
+    }
+  }
 }
 
 void TriangleMesh::initialize(const geometry::Mesh &mesh) {
   clear();
-  size_t i{0};
-  size_t n{0};
-  for (auto &face : mesh.faces)
-    if (face.count >= 3) n += face.count - 2;
-  positions.resize(3 * n);
-  if (mesh.texcoords) texcoords.emplace(with_shape, 3 * n);
-  if (mesh.normals) normals.emplace(with_shape, 3 * n);
-  materials.emplace(with_shape, n);
+  // Merge the corners whose attribute indexes are identical, so that shared vertices are shared here too.
+  std::unordered_map<VertexKey<3>, uint32_t, VertexKeyHash<3>> vertexIndexes;
+  std::vector<VertexKey<3>> vertexKeys;
+  std::vector<uint32_t> triangleIndexes;
+  std::vector<int16_t> triangleMaterials;
+  auto vertexIndexOf = [&](const geometry::Mesh::Face &face, uint32_t j) {
+    VertexKey<3> key;
+    key.words[0] = mesh.positions.f[face.first + j];
+    if (mesh.texcoords) key.words[1] = mesh.texcoords.f[face.first + j];
+    if (mesh.normals) key.words[2] = mesh.normals.f[face.first + j];
+    auto [itr, inserted] = vertexIndexes.try_emplace(key, uint32_t(vertexKeys.size()));
+    if (inserted) vertexKeys.push_back(key);
+    return itr->second;
+  };
   for (auto &face : mesh.faces) {
     for (uint32_t j = 1; j + 1 < face.count; j++) {
-      positions.row(3 * i + 0).assign(mesh.positions(face, 0));
-      positions.row(3 * i + 1).assign(mesh.positions(face, j));
-      positions.row(3 * i + 2).assign(mesh.positions(face, j + 1));
-      if (mesh.texcoords) {
-        texcoords->row(3 * i + 0).assign(mesh.texcoords(face, 0));
-        texcoords->row(3 * i + 1).assign(mesh.texcoords(face, j));
-        texcoords->row(3 * i + 2).assign(mesh.texcoords(face, j + 1));
-      }
-      if (mesh.normals) {
-        normals->row(3 * i + 0).assign(mesh.normals(face, 0));
-        normals->row(3 * i + 1).assign(mesh.normals(face, j));
-        normals->row(3 * i + 2).assign(mesh.normals(face, j + 1));
-      }
-      (*materials)[i] = face.metadata.material;
-      ++i;
+      triangleIndexes.push_back(vertexIndexOf(face, 0));
+      triangleIndexes.push_back(vertexIndexOf(face, j));
+      triangleIndexes.push_back(vertexIndexOf(face, j + 1));
+      triangleMaterials.push_back(face.metadata.material);
     }
   }
+  const size_t numVerts{vertexKeys.size()};
+  positions.resize(numVerts);
+  if (mesh.texcoords) texcoords.emplace(with_shape, numVerts);
+  if (mesh.normals) normals.emplace(with_shape, numVerts);
+  for (size_t v = 0; v < numVerts; v++) {
+    positions.row(v).assign(mesh.positions.v[vertexKeys[v].words[0]]);
+    if (mesh.texcoords) texcoords->row(v).assign(mesh.texcoords.v[vertexKeys[v].words[1]]);
+    if (mesh.normals) normals->row(v).assign(mesh.normals.v[vertexKeys[v].words[2]]);
+  }
+  indexes = Vector<uint32_t, Dynamic>{with_shape, triangleIndexes.size()};
+  std::copy(triangleIndexes.begin(), triangleIndexes.end(), indexes.begin());
+  materials.emplace(with_shape, triangleMaterials.size());
+  std::copy(triangleMaterials.begin(), triangleMaterials.end(), materials->begin());
   initialize();
 }
 
@@ -134,36 +348,143 @@ void TriangleMesh::validate() {
   auto validateSameSizeAsPositions = [&](auto &values, const char *name) {
     if (values && values->rows() != positions.rows()) throw Error(std::runtime_error("Triangle mesh validation failed! ({} positions, but {} {})"_format(positions.rows(), values->rows(), name)));
   };
+  auto validateQuantized = [&](auto &values, size_t width, const char *name) {
+    if (!values.empty() && values.size() != width * positions.rows()) throw Error(std::runtime_error("Triangle mesh validation failed! ({} positions, but {} quantized {})"_format(positions.rows(), values.size() / width, name)));
+  };
   validateSameSizeAsPositions(texcoords, "texcoords");
   validateSameSizeAsPositions(normals, "normals");
   validateSameSizeAsPositions(tangents, "tangents");
+  validateQuantized(quantizedTexcoords, 2, "texcoords");
+  validateQuantized(quantizedNormals, 1, "normals");
+  validateQuantized(quantizedTangents, 1, "tangents");
+  if (indexes.size() == 0 && positions.rows() % 3 != 0) throw Error(std::runtime_error("Triangle mesh validation failed! ({} unindexed positions, which is not a multiple of 3)"_format(positions.rows())));
+  if (indexes.size() % 3 != 0) throw Error(std::runtime_error("Triangle mesh validation failed! ({} indexes, which is not a multiple of 3)"_format(indexes.size())));
+  for (uint32_t index : indexes)
+    if (index >= positions.rows()) throw Error(std::runtime_error("Triangle mesh validation failed! ({} positions, but index {})"_format(positions.rows(), index)));
   if (materials && materials->size() != numTris()) throw Error(std::runtime_error("Triangle mesh validation failed! ({} triangles, but {} materials)"_format(numTris(), materials->size())));
 }
 
+Vector2d TriangleMesh::vertexTexcoord(uint32_t vertexIndex) const noexcept {
+  if (texcoords) return Vector2d(texcoords->row(vertexIndex));
+  if (!quantizedTexcoords.empty()) return Vector2d(float(quantizedTexcoords[2 * vertexIndex + 0]), float(quantizedTexcoords[2 * vertexIndex + 1]));
+  return {};
+}
+
+Vector3d TriangleMesh::vertexNormal(uint32_t vertexIndex) const noexcept {
+  if (normals) return Vector3d(normals->row(vertexIndex));
+  if (!quantizedNormals.empty()) return decodeOctahedral(quantizedNormals[vertexIndex]);
+  return {};
+}
+
+Vector3d TriangleMesh::vertexTangent(uint32_t vertexIndex) const noexcept {
+  if (tangents) return Vector3d(tangents->row(vertexIndex));
+  if (!quantizedTangents.empty()) return decodeOctahedral(quantizedTangents[vertexIndex]);
+  return {};
+}
+
+Triangle TriangleMesh::triangle(uint32_t i) const noexcept {
+  return {
+    vertexPosition(indexes[3 * i + 0]), //
+    vertexPosition(indexes[3 * i + 1]), //
+    vertexPosition(indexes[3 * i + 2])};
+}
+
 std::optional<double> TriangleMesh::intersect(Ray3d ray, Manifold &manifold) const noexcept {
   std::optional<double> rayParam;
-  triangleBVH.visitRayCast(ray, [&](auto node) -> bool {
-    for (uint32_t i = node.first; i < node.first + node.count; i++) {
-      Triangle triangle{
-        Vector3d(positions.row(3 * i)),     //
-        Vector3d(positions.row(3 * i + 1)), //
-        Vector3d(positions.row(3 * i + 2))};
-      if (auto param = triangle.intersect(ray, manifold)) {
-        ray.maxParam = *param, rayParam = param;
-        manifold.primitiveIndex = i;
-      }
-    }
+  PackHit hit;
+  triangleWideBVH.visitRayCast(ray, [&](uint32_t packIndex, uint32_t count) -> bool {
+    if (intersectPack(packIndex, count, ray, hit)) rayParam = ray.maxParam;
     return true; // Continue.
   });
   if (rayParam) {
-    interpolateShading(manifold);
+    finishHit(hit, manifold);
   }
   return rayParam;
 }
 
+std::vector<std::optional<double>> TriangleMesh::intersect(std::span<const Ray3d> rays, std::span<Manifold> manifolds) const {
+  if (rays.size() != manifolds.size()) [[unlikely]]
+    throw Error(std::logic_error("Call to TriangleMesh::intersect() failed! Reason: {} rays, but {} manifolds"_format(rays.size(), manifolds.size())));
+  std::vector<std::optional<double>> rayParams(rays.size());
+  std::vector<PackHit> hits(rays.size());
+  std::vector<Ray3d> raysCopy(rays.begin(), rays.end());
+  triangleWideBVH.visitRayCastStream(std::span<Ray3d>(raysCopy), [&](uint32_t packIndex, uint32_t count, uint32_t rayIndex) -> bool {
+    if (intersectPack(packIndex, count, raysCopy[rayIndex], hits[rayIndex])) rayParams[rayIndex] = raysCopy[rayIndex].maxParam;
+    return true; // Continue.
+  });
+  for (size_t rayIndex = 0; rayIndex < rays.size(); rayIndex++)
+    if (rayParams[rayIndex]) finishHit(hits[rayIndex], manifolds[rayIndex]);
+  return rayParams;
+}
+
+bool TriangleMesh::intersectPack(uint32_t packIndex, uint32_t count, Ray3d &ray, PackHit &hit) const noexcept {
+  // Moller-Trumbore for all triangles in the pack at once. This is written as straight loops over the
+  // lanes so that the compiler can vectorize it.
+  constexpr size_t Width = TrianglePackWidth;
+  const TrianglePack &pack{trianglePacks[packIndex]};
+  double params[Width];
+  double params0[Width];
+  double params1[Width];
+  bool hits[Width];
+  float origins[3][Width];
+  float edges1[3][Width];
+  float edges2[3][Width];
+  for (size_t j = 0; j < Width; j++) {
+    const float *point0{&positions(pack.vertexIndexes[0][j], 0)};
+    const float *point1{&positions(pack.vertexIndexes[1][j], 0)};
+    const float *point2{&positions(pack.vertexIndexes[2][j], 0)};
+    for (size_t axis = 0; axis < 3; axis++) {
+      origins[axis][j] = point0[axis];
+      edges1[axis][j] = point1[axis] - point0[axis];
+      edges2[axis][j] = point2[axis] - point0[axis];
+    }
+  }
+  for (size_t j = 0; j < Width; j++) {
+    double edge1[3]{edges1[0][j], edges1[1][j], edges1[2][j]};
+    double edge2[3]{edges2[0][j], edges2[1][j], edges2[2][j]};
+    double delta[3]{ray.origin[0] - origins[0][j], ray.origin[1] - origins[1][j], ray.origin[2] - origins[2][j]};
+    double vectorP[3]{
+      ray.direction[1] * edge2[2] - ray.direction[2] * edge2[1], //
+      ray.direction[2] * edge2[0] - ray.direction[0] * edge2[2], //
+      ray.direction[0] * edge2[1] - ray.direction[1] * edge2[0]};
+    double vectorQ[3]{
+      delta[1] * edge1[2] - delta[2] * edge1[1], //
+      delta[2] * edge1[0] - delta[0] * edge1[2], //
+      delta[0] * edge1[1] - delta[1] * edge1[0]};
+    double determinant{edge1[0] * vectorP[0] + edge1[1] * vectorP[1] + edge1[2] * vectorP[2]};
+    double factor{1 / determinant};
+    params0[j] = factor * (delta[0] * vectorP[0] + delta[1] * vectorP[1] + delta[2] * vectorP[2]);
+    params1[j] = factor * (ray.direction[0] * vectorQ[0] + ray.direction[1] * vectorQ[1] + ray.direction[2] * vectorQ[2]);
+    params[j] = factor * (edge2[0] * vectorQ[0] + edge2[1] * vectorQ[1] + edge2[2] * vectorQ[2]);
+    hits[j] = j < count &&                                    //
+              abs(determinant) > constants::MinInv<double> && //
+              params0[j] > -Triangle::Eps &&                  //
+              params1[j] > -Triangle::Eps &&                  //
+              params0[j] + params1[j] < 1 + Triangle::Eps &&  //
+              ray.minParam <= params[j] && params[j] <= ray.maxParam;
+  }
+  bool result{false};
+  for (size_t j = 0; j < Width; j++) {
+    if (hits[j] && params[j] <= ray.maxParam) {
+      ray.maxParam = params[j];
+      hit.index = pack.index[j];
+      hit.parameters = {params0[j], params1[j]};
+      result = true;
+    }
+  }
+  return result;
+}
+
+void TriangleMesh::finishHit(const PackHit &hit, Manifold &manifold) const noexcept {
+  manifold = triangle(hit.index).parameterization(hit.parameters);
+  manifold.primitiveIndex = hit.index;
+  interpolateShading(manifold);
+}
+
 std::optional<double> TriangleMesh::nearestTo(Vector3d referencePoint, Manifold &manifold) const noexcept {
   auto todo{GrowableMaxHeap<std::pair<double, const geometry::ImmutableBVH3::Node *>, 64>{}};
   auto dist{manifold.nearestDistance};
+  bool found{false};
   if (!triangleBVH.nodes.empty()) {
     auto root{&triangleBVH.nodes[0]};
     auto rootDist{distance(referencePoint, root->box.clamp(referencePoint))};
@@ -185,18 +506,15 @@ std::optional<double> TriangleMesh::nearestTo(Vector3d referencePoint, Manifold
       if (childDistA < dist) todo.push({childDistA, childA});
     } else {
       for (uint32_t i = node->first; i < node->first + node->count; i++) {
-        Triangle triangle{
-          Vector3d(positions.row(3 * i)),     //
-          Vector3d(positions.row(3 * i + 1)), //
-          Vector3d(positions.row(3 * i + 2))};
-        if (auto thisDist = triangle.nearestTo(referencePoint, manifold)) {
+        if (auto thisDist = triangle(i).nearestTo(referencePoint, manifold)) {
           dist = *thisDist;
           manifold.primitiveIndex = i;
+          found = true;
         }
       }
     }
   }
-  if (!(dist < manifold.nearestDistance)) {
+  if (!found) {
     return std::nullopt;
   } else {
     manifold.nearestDistance = dist;
@@ -209,45 +527,38 @@ void TriangleMesh::interpolateShading(Manifold &manifold) const noexcept {
   auto &correct{manifold.correct};
   auto &shading{manifold.shading};
   shading = correct;
-  if (!(!texcoords && !normals && !tangents)) {
+  if (hasTexcoords() || hasNormals() || hasTangents()) {
     size_t i{manifold.primitiveIndex};
+    uint32_t vertexIndexes[3]{indexes[3 * i + 0], indexes[3 * i + 1], indexes[3 * i + 2]};
     Vector3d barycentric{
       1 - correct.parameters.sum(), //
       correct.parameters[0],        //
       correct.parameters[1]};
-    if (texcoords) {
-      Vector2d texcoord0{texcoords->row(3 * i + 0)};
-      Vector2d texcoord1{texcoords->row(3 * i + 1)};
-      Vector2d texcoord2{texcoords->row(3 * i + 2)};
+    if (hasTexcoords()) {
+      Vector2d texcoord0{vertexTexcoord(vertexIndexes[0])};
+      Vector2d texcoord1{vertexTexcoord(vertexIndexes[1])};
+      Vector2d texcoord2{vertexTexcoord(vertexIndexes[2])};
       shading.parameters = barycentric[0] * texcoord0 + barycentric[1] * texcoord1 + barycentric[2] * texcoord2;
-      if (!tangents) {
-        try {
-          Matrix2d matrixA;
-          matrixA.row(0).assign(texcoord1 - texcoord0);
-          matrixA.row(1).assign(texcoord2 - texcoord0);
-          Matrix2x3d matrixB;
-          matrixB.row(0).assign(correct.tangents[0]);
-          matrixB.row(1).assign(correct.tangents[1]);
-          Matrix2x3d matrixX = DecompLU{matrixA}.solve(matrixB);
-          shading.tangents[0] = matrixX.row(0);
-          shading.tangents[1] = matrixX.row(1);
-        } catch (...) {
-          // If the LU decomposition fails, the UV map is degenerate. Just leave the shading-tangents the same
-          // as the correct tangents.
+      if (texcoordTangents) {
+        Vector3d tangent0{texcoordTangents->row(2 * i + 0)};
+        Vector3d tangent1{texcoordTangents->row(2 * i + 1)};
+        if (!allTrue(tangent0 == 0)) {
+          shading.tangents[0] = tangent0;
+          shading.tangents[1] = tangent1;
         }
       }
     }
-    if (normals) {
+    if (hasNormals()) {
       shading.normal = normalize(
-        barycentric[0] * Vector3d(normals->row(3 * i + 0)) + //
-        barycentric[1] * Vector3d(normals->row(3 * i + 1)) + //
-        barycentric[2] * Vector3d(normals->row(3 * i + 2)));
+        barycentric[0] * vertexNormal(vertexIndexes[0]) + //
+        barycentric[1] * vertexNormal(vertexIndexes[1]) + //
+        barycentric[2] * vertexNormal(vertexIndexes[2]));
     }
-    if (tangents) {
+    if (hasTangents()) {
       shading.tangents[0] = normalize(
-        barycentric[0] * Vector3d(tangents->row(3 * i + 0)) + //
-        barycentric[1] * Vector3d(tangents->row(3 * i + 1)) + //
-        barycentric[2] * Vector3d(tangents->row(3 * i + 2)));
+        barycentric[0] * vertexTangent(vertexIndexes[0]) + //
+        barycentric[1] * vertexTangent(vertexIndexes[1]) + //
+        barycentric[2] * vertexTangent(vertexIndexes[2]));
       shading.tangents[1] = normalize(cross(shading.normal, shading.tangents[0]));
     }
   }
@@ -37,23 +37,50 @@ void Path::Vertex::invokeMaterialProvider(const Spectrum &waveLens) {
 }
 
 void PathConnector::connect(Random &random, PathView pathA, PathView pathB, const Receiver &receiver) const {
+  std::vector<Path::Vertex> completions;
+  std::vector<Candidate> candidates;
+  completions.reserve(pathA.size() + pathB.size());
+  accumulatePartialWeights(pathA);
+  accumulatePartialWeights(pathB);
+  candidates.reserve((pathA.size() + 1) * (pathB.size() + 1));
   for (ptrdiff_t i = 0; i <= pathA.size(); i++) {
     for (ptrdiff_t j = 0; j <= pathB.size(); j++) {
-      connectTerm(random, IteratorRange(&pathA[0], i), IteratorRange(&pathB[0], j), receiver);
+      Candidate &candidate{candidates.emplace_back()};
+      if (!formCandidate(random, IteratorRange(&pathA[0], i), IteratorRange(&pathB[0], j), completions, candidate)) candidates.pop_back();
     }
   }
+  resolveVisibility(pathA, pathB, completions, candidates);
+  for (const Candidate &candidate : candidates) receive(pathA, pathB, completions, candidate, receiver);
 }
 
 void PathConnector::connectTerm(Random &random, PathView pathA, PathView pathB, const Receiver &receiver) const {
-  auto doTruncation = [&](Path::Vertex &vertexP) -> void {
+  std::vector<Path::Vertex> completions;
+  completions.reserve(1);
+  accumulatePartialWeights(pathA);
+  accumulatePartialWeights(pathB);
+  Candidate candidate;
+  if (formCandidate(random, pathA, pathB, completions, candidate)) {
+    resolveVisibility(pathA, pathB, completions, std::span<Candidate>(&candidate, 1));
+    receive(pathA, pathB, completions, candidate, receiver);
+  }
+}
+
+bool PathConnector::formCandidate(Random &random, PathView pathA, PathView pathB, std::vector<Path::Vertex> &completions, Candidate &candidate) const {
+  candidate.sizeA = pathA.size();
+  candidate.sizeB = pathB.size();
+  auto doTruncation = [&](Path::Vertex &vertexP) -> bool {
     Path::Kind kind{vertexP.runtime.kind};
     if (mTruncater(vertexP)) {
       if (vertexP.runtime.kind != kind) [[unlikely]]
         throw Error(std::logic_error("Call to PathConnector::connectTerm() failed! Reason: Truncation operator must return same kind of vertex!"));
-      receiver(pathA, pathB, multipleImportanceWeight(pathA, pathB), vertexP.runtime.ratio);
+      candidate.weight = multipleImportanceWeightIncremental(pathA, pathB);
+      candidate.L = vertexP.runtime.ratio;
+      return true;
     }
+    return false;
   };
-  auto doCompletion = [&](Path::Vertex &vertexP, Path::Vertex &vertexQ) -> std::optional<Spectrum> {
+  auto doCompletion = [&](Path::Vertex &vertexP, PathView &pathQ) -> bool {
+    Path::Vertex &vertexQ{completions.emplace_back()};
     if (mCompleter(vertexP, vertexQ)) {
       if (vertexP.runtime.kind == vertexQ.runtime.kind) [[unlikely]]
         throw Error(std::logic_error("Call to PathConnector::connectTerm() failed! Reason: Completion operator must return opposite kind of vertex!"));
@@ -63,27 +90,31 @@ void PathConnector::connectTerm(Random &random, PathView pathA, PathView pathB,
       if (Spectrum L{
             vertexP.runtime.ratio * fP * //
             vertexQ.runtime.ratio};
-          isPositiveAndFinite(L) && mVisibilityTester(vertexP, vertexQ, L)) {
-        return L;
+          isPositiveAndFinite(L)) {
+        pathQ = PathView(&vertexQ, 1);
+        candidate.completion = completions.size() - 1;
+        candidate.weight = multipleImportanceWeightIncremental(pathA, pathB);
+        candidate.L = std::move(L);
+        candidate.needsVisibility = true;
+        return true;
       }
     }
-    return {};
+    completions.pop_back();
+    return false;
   };
   const PathBackup backups[2]{PathBackup(pathA), PathBackup(pathB)};
   if (pathA.empty() && pathB.empty()) [[unlikely]] {
-    return;
+    return false;
   } else if (pathA.empty()) {
-    doTruncation(pathB.back()); // Apply truncation to path B when path A is empty.
+    return doTruncation(pathB.back()); // Apply truncation to path B when path A is empty.
   } else if (pathB.empty()) {
-    doTruncation(pathA.back()); // Apply truncation to path A when path B is empty.
+    return doTruncation(pathA.back()); // Apply truncation to path A when path B is empty.
   } else if (pathA.size() == 1 && pathB.size() == 1) [[unlikely]] {
-    return;
+    return false;
   } else if (pathA.size() == 1) { // Implied: && pathB.size() > 1
-    Path::Vertex vertexA;
-    if (auto L = doCompletion(pathB.back(), vertexA)) receiver(PathView(&vertexA, 1), pathB, multipleImportanceWeight(PathView(&vertexA, 1), pathB), *L);
+    return doCompletion(pathB.back(), pathA);
   } else if (pathB.size() == 1) { // Implied: && pathA.size() > 1
-    Path::Vertex vertexB;
-    if (auto L = doCompletion(pathA.back(), vertexB)) receiver(pathA, PathView(&vertexB, 1), multipleImportanceWeight(pathA, PathView(&vertexB, 1)), *L);
+    return doCompletion(pathA.back(), pathB);
   } else {
     // Connect paths.
     auto &vertexA{pathA.back()};
@@ -92,7 +123,7 @@ void PathConnector::connectTerm(Random &random, PathView pathA, PathView pathB,
       return !vertexA.runtime.flags.isIncomplete && vertexA.material.hasScattering() && //
              !vertexB.runtime.flags.isIncomplete && vertexB.material.hasScattering();
     };
-    if (!isConnectible()) return;
+    if (!isConnectible()) return false;
     Vector3d omegaI{vertexA.omega(vertexB)};
     Spectrum fA{spectrumZerosLike(vertexA.runtime.ratio)};
     Spectrum fB{spectrumZerosLike(vertexB.runtime.ratio)};
@@ -102,13 +133,114 @@ void PathConnector::connectTerm(Random &random, PathView pathA, PathView pathB,
           vertexA.runtime.ratio * fA * //
           vertexB.runtime.ratio * fB * //
           (1.0 / distanceSquare(vertexA.position, vertexB.position))};
-        isPositiveAndFinite(L) && mVisibilityTester(vertexA, vertexB, L)) {
-      receiver(pathA, pathB, multipleImportanceWeight(pathA, pathB), L);
+        isPositiveAndFinite(L)) {
+      candidate.weight = multipleImportanceWeightIncremental(pathA, pathB);
+      candidate.L = std::move(L);
+      candidate.needsVisibility = true;
+      return true;
     }
+    return false;
+  }
+}
+
+void PathConnector::resolveVisibility(PathView pathA, PathView pathB, std::vector<Path::Vertex> &completions, std::span<Candidate> candidates) const {
+  std::vector<VisibilityQuery> queries;
+  std::vector<Candidate *> queryCandidates;
+  for (Candidate &candidate : candidates) {
+    if (!candidate.needsVisibility) continue;
+    const Path::Vertex &vertexA{candidate.sizeA == 1 && candidate.completion >= 0 ? completions[candidate.completion] : pathA[candidate.sizeA - 1]};
+    const Path::Vertex &vertexB{candidate.sizeB == 1 && candidate.completion >= 0 ? completions[candidate.completion] : pathB[candidate.sizeB - 1]};
+    // Note: The completion vertex is always the second vertex of the query, as the completion operator sees it.
+    if (candidate.sizeA == 1 && candidate.completion >= 0)
+      queries.push_back({&vertexB, &vertexA, &candidate.L});
+    else
+      queries.push_back({&vertexA, &vertexB, &candidate.L});
+    queryCandidates.push_back(&candidate);
+  }
+  if (queries.empty()) return;
+  if (mBatchVisibilityTester) {
+    mBatchVisibilityTester(queries);
+  } else {
+    for (VisibilityQuery &query : queries) query.isVisible = mVisibilityTester(*query.vertexP, *query.vertexQ, *query.L);
   }
+  for (size_t k = 0; k < queries.size(); k++) queryCandidates[k]->isVisible = queries[k].isVisible;
+}
+
+void PathConnector::receive(PathView pathA, PathView pathB, std::vector<Path::Vertex> &completions, const Candidate &candidate, const Receiver &receiver) const {
+  if (!candidate.isVisible) return;
+  PathView subpathA{&pathA[0], size_t(candidate.sizeA)};
+  PathView subpathB{&pathB[0], size_t(candidate.sizeB)};
+  if (candidate.completion >= 0) (candidate.sizeA == 1 ? subpathA : subpathB) = PathView(&completions[candidate.completion], 1);
+  receiver(subpathA, subpathB, candidate.weight, candidate.L);
+}
+
+double PathConnector::nextPartialWeight(double denom, const Path::Vertex &vertex, ptrdiff_t index, double reversePathPDF) const noexcept {
+  if (!vertex.runtime.flags.isDeltaScattering) {
+    denom *= reversePathPDF / vertex.runtime.pathPDF.forward;
+    denom += vertex.runtime.flags.isIncomplete ? 0 : 1;
+    // If merging, the strategy which merges at this vertex samples it from both sides, so relative to the strategy
+    // which connects here it has the extra factor of the reverse path PDF times the merge factor.
+    if (mMergeFactor > 0 && isMergeable(vertex, index)) denom += mMergeFactor * reversePathPDF;
+  }
+  return denom;
+}
+
+void PathConnector::accumulatePartialWeights(PathView path) const noexcept {
+  double denom{1};
+  for (ptrdiff_t k = 0; k < path.size(); k++) path[k].runtime.partialWeight = denom = nextPartialWeight(denom, path[k], k, path[k].runtime.pathPDF.reverse);
+}
+
+void PathConnector::merge(Random &random, PathView pathA, ConstPathView pathB, const Receiver &receiver) const {
+  ptrdiff_t nA{pathA.size()};
+  ptrdiff_t nB{pathB.size()};
+  if (!(mMergeFactor > 0)) [[unlikely]]
+    throw Error(std::logic_error("Call to PathConnector::merge() failed! Reason: Merge factor must be positive!"));
+  if (nA < 2 || nB < 2) return;
+  auto &vertexA{pathA.back()};
+  auto &vertexB{pathB.back()};
+  if (!isMergeable(vertexA, nA - 1) || !isMergeable(vertexB, nB - 1) || !vertexA.material.hasScattering()) return;
+  double weight{0};
+  Spectrum L{};
+  auto formMerge = [&]() -> bool {
+    const PathBackup backup(pathA);
+    Vector3d omegaI{vertexB.runtime.omegaO};
+    Spectrum fA{spectrumZerosLike(vertexA.runtime.ratio)};
+    vertexA.runtime.scatteringPDF = vertexA.material.scatter(random, vertexA.runtime.omegaO, omegaI, fA);
+    // The scattering function includes the projected cosine of the incident direction, which the density
+    // estimate does not want, because the area density of the vertex on path B already accounts for it.
+    L = Spectrum{
+      vertexA.runtime.ratio * fA * //
+      vertexB.runtime.ratio * finiteOrZero(1 / (mMergeFactor * vertexA.shadingAbsCosTheta(omegaI)))};
+    if (!isPositiveAndFinite(L)) return false;
+
+    // Determine the multiple importance weight. This is the same idea as in multipleImportanceWeight(), except
+    // that the strategy we actually used samples the merged vertex from both sides, so we normalize by its density
+    // relative to the connection of the second-to-last vertices, which is the merge factor times the forward path
+    // PDF of the merged vertex on either side. We recalculate the reverse path PDFs of the second-to-last vertices
+    // as if the merged vertex connected them, but without writing anything to path B.
+    auto finishPartialWeight = [&](ConstPathView path, double reversePathPDF) {
+      ptrdiff_t n{path.size()};
+      double denom{n > 2 ? path[n - 3].runtime.partialWeight : 1.0};
+      return nextPartialWeight(denom, path[n - 2], n - 2, reversePathPDF);
+    };
+    pathA[nA - 2].recalculateReversePathPDF(vertexA);
+    double denomA{finishPartialWeight(pathA, pathA[nA - 2].runtime.pathPDF.reverse)};
+    double denomB{finishPartialWeight(pathB, pathB[nB - 2].runtime.flags.isIntangible ? 0.0 : vertexA.runtime.scatteringPDF.forward * convertSolidAngleToPath(vertexA, pathB[nB - 2]))};
+    weight = finiteOrZero(
+      1 / (1 + denomA / (mMergeFactor * vertexA.runtime.pathPDF.forward) + //
+           denomB / (mMergeFactor * vertexB.runtime.pathPDF.forward)));
+    return true;
+  };
+  if (formMerge()) receiver(pathA, pathB, weight, L); // Note: The backup is out of scope here, as in connect().
 }
 
 double PathConnector::multipleImportanceWeight(PathView pathA, PathView pathB) const {
+  accumulatePartialWeights(pathA);
+  accumulatePartialWeights(pathB);
+  return multipleImportanceWeightIncremental(pathA, pathB);
+}
+
+double PathConnector::multipleImportanceWeightIncremental(PathView pathA, PathView pathB) const {
   // Recalculate the relevant conjugate path-space PDFs.
   ptrdiff_t nA{pathA.size()};
   ptrdiff_t nB{pathB.size()};
@@ -145,20 +277,18 @@ double PathConnector::multipleImportanceWeight(PathView pathA, PathView pathB) c
   // balance heuristic, as in the initial example with P/(P+Q+R), we can divide through by the numerator to obtain
   // an equivalent expression 1/(1+D) where D=Q/P+R/P. If we do that, we obtain signficant term cancellation that
   // results in a nested arithmetic expression (1+Ri)Rj where Ri is the ratio of the reverse to forward PDFs.
-  double denomA{1};
-  double denomB{1};
-  for (auto &vertex : pathA) {
-    if (!vertex.runtime.flags.isDeltaScattering) {
-      denomA *= vertex.runtime.pathPDF.reverse / vertex.runtime.pathPDF.forward;
-      denomA += vertex.runtime.flags.isIncomplete ? 0 : 1;
-    }
-  }
-  for (auto &vertex : pathB) {
-    if (!vertex.runtime.flags.isDeltaScattering) {
-      denomB *= vertex.runtime.pathPDF.reverse / vertex.runtime.pathPDF.forward;
-      denomB += vertex.runtime.flags.isIncomplete ? 0 : 1;
-    }
-  }
+  //
+  // The nested expression is a running sum along each subpath, and the connection only disturbs the reverse path PDFs
+  // of the last two vertices. So we resume from the partial sum at the third-to-last vertex and only finish the last
+  // two terms here, which makes the weight for every strategy constant time instead of linear in the path length.
+  auto finishPartialWeight = [&](PathView path) {
+    ptrdiff_t n{path.size()};
+    double denom{n > 2 ? path[n - 3].runtime.partialWeight : 1.0};
+    for (ptrdiff_t k = max(n - 2, ptrdiff_t(0)); k < n; k++) denom = nextPartialWeight(denom, path[k], k, path[k].runtime.pathPDF.reverse);
+    return denom;
+  };
+  double denomA{finishPartialWeight(pathA)};
+  double denomB{finishPartialWeight(pathB)};
   return finiteOrZero(1 / (denomA + denomB - 1));
 }
 
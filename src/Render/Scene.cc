@@ -3,22 +3,31 @@
 namespace mi::render {
 
 Path Scene::walk(const Spectrum &waveLens, Random &random, Path::Vertex firstVertex, int maxDepth) const {
-  if (maxDepth == 0) return {};
+  Path path;
+  walk(waveLens, random, std::move(firstVertex), path, maxDepth);
+  return path;
+}
+
+void Scene::walk(const Spectrum &waveLens, Random &random, Path::Vertex firstVertex, Path &path, int maxDepth) const {
+  path.clear();
+  if (maxDepth == 0) return;
   Ray3d ray{firstVertex.position, firstVertex.runtime.omegaI, mShadowEpsilon, Inf};
   Medium medium{firstVertex.material.medium(ray.direction)};
   Spectrum ratio{firstVertex.runtime.ratio};
-  Path path;
   path.push(std::move(firstVertex));
   for (int depth = 1; depth < maxDepth || maxDepth < 0; depth++) {
     {
       bool intersected{false};       // Intersected anything?
       bool intersectedVolume{false}; // Intersected volume specifically?
-      const auto &lastVertex{path.back()};
+
+      // Construct the vertex in place, recycling the storage of whatever vertex previously occupied
+      // the slot. Note: This must happen before we take the reference to the last vertex!
+      Path::Vertex &vertex{path.emplace()};
+      const auto &lastVertex{path[path.size() - 2]};
 
       // First use the surface intersection routine. If we intersect something, truncate the ray
       // parameter (which establishes the maximum distance for medium transmission) and remember
       // that we hit something by setting intersected=true.
-      Path::Vertex vertex;
       if (auto param = mIntersect(ray, vertex)) {
         ray.maxParam = *param, intersected = true;
         vertex.assertValidInitialSurfaceVertex(); // Sanity checks.
@@ -47,6 +56,7 @@ Path Scene::walk(const Spectrum &waveLens, Random &random, Path::Vertex firstVer
           ray.maxParam = Inf;
           medium = vertex.material.medium(ray.direction);
           depth--; // Also do not count this iteration as a bounce!
+          path.pop();
           continue;
         }
       }
@@ -56,7 +66,7 @@ Path Scene::walk(const Spectrum &waveLens, Random &random, Path::Vertex firstVer
 
       // Initialize ratio and directions. We set omegaI opposite omegaO initially because that is
       // the desirable default behavior for non-scattering interfaces that separate media.
-      vertex.runtime.ratio = ratio;
+      vertex.assignRatio(ratio);
       vertex.runtime.omegaO = -ray.direction;
       vertex.runtime.omegaI = +ray.direction;
 
@@ -67,7 +77,6 @@ Path Scene::walk(const Spectrum &waveLens, Random &random, Path::Vertex firstVer
       }
 
       vertex.recalculateForwardPathPDF(lastVertex);
-      path.push(std::move(vertex));
 
       if (!intersected) break; // If we intersected nothing, we're done.
     }
@@ -101,7 +110,6 @@ Path Scene::walk(const Spectrum &waveLens, Random &random, Path::Vertex firstVer
     ray = Ray3d{vertex.position, vertex.runtime.omegaI, mShadowEpsilon, Inf}, medium = vertex.material.medium(ray.direction);
   }
   for (size_t i = 0; i + 1 < path.size(); i++) path[i].recalculateReversePathPDF(path[i + 1]);
-  return path;
 }
 
 bool Scene::visibility(const Spectrum &waveLens, Random &random, const Path::Vertex &firstVertex, Vector3d omegaI, double maxDistance, Spectrum &tr) const {
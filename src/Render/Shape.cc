@@ -2,32 +2,116 @@
 
 namespace mi::render {
 
-BoundBox3d ShapeGroup::box() const {
-  return BoundBox3d(mShapes, [](const Shape &shape) -> BoundBox3d { return shape.box(); });
+ShapeInstances::ShapeInstances(std::vector<std::shared_ptr<const Shape>> prototypes, std::vector<Instance> instances, const geometry::ImmutableBVH3::BuildOptions &options)
+  : mPrototypes(std::move(prototypes)), mInstances(std::move(instances)) {
+  for (const auto &prototype : mPrototypes)
+    if (!prototype) [[unlikely]]
+      throw Error(std::invalid_argument("Call to ShapeInstances() failed! Reason: Null prototype"));
+  for (const auto &instance : mInstances)
+    if (instance.prototype >= mPrototypes.size()) [[unlikely]]
+      throw Error(std::invalid_argument("Call to ShapeInstances() failed! Reason: Prototype index out of range"));
+  if (mInstances.empty()) return;
+  geometry::ImmutableBVH3::Items items;
+  items.reserve(mInstances.size());
+  for (size_t i = 0; i < mInstances.size(); i++) {
+    auto &item = items.emplace_back();
+    auto box{instanceBox(mInstances[i])};
+    item.index = i;
+    item.box = conservativeBox(box);
+    item.boxCenter = item.box.center();
+    mBox |= box;
+  }
+  auto buildOptions{options};
+  buildOptions.leafLimit = std::clamp<int>(buildOptions.leafLimit, 1, 255);
+  buildOptions.spatialSplits = false;
+  mBVH.build(buildOptions, items);
+  mInstanceIndexes.reserve(items.size());
+  for (auto &item : items) mInstanceIndexes.push_back(item.index);
 }
 
-std::optional<double> ShapeGroup::intersect(Ray3d ray, Manifold &manifold) const {
+std::optional<double> ShapeInstances::intersect(Ray3d ray, Manifold &manifold) const {
   std::optional<double> best{};
-  for (auto &shape : mShapes) {
-    if (shape.box().rayCast(ray)) {
-      if (auto param = shape.intersect(ray, manifold)) {
+  mBVH.visitRayCast(ray, [&](const geometry::ImmutableBVH3::Node &node) {
+    for (uint32_t i = node.first; i < node.first + node.count; i++) {
+      const uint32_t instanceIndex{mInstanceIndexes[i]};
+      const Instance &instance{mInstances[instanceIndex]};
+      // Note: The direction is not renormalized in local space, so the parameters agree in both spaces.
+      Ray3d localRay{ray};
+      localRay >>= inverse(instance.transform);
+      if (auto param = mPrototypes[instance.prototype]->intersect(localRay, manifold)) {
+        manifold >>= instance.transform;
+        manifold.correct.normal = normalize(manifold.correct.normal);
+        manifold.shading.normal = normalize(manifold.shading.normal);
+        manifold.instanceIndex = instanceIndex;
         ray.maxParam = *param, best = param;
       }
     }
-  }
+    return true;
+  });
   return best;
 }
 
-std::optional<double> ShapeGroup::nearestTo(Vector3d referencePoint, Manifold &manifold) const {
+std::optional<double> ShapeInstances::nearestTo(Vector3d referencePoint, Manifold &manifold) const {
   std::optional<double> best{};
-  for (auto &shape : mShapes) {
-    if (auto distToBox = distance(referencePoint, shape.box().clamp(referencePoint)); distToBox < manifold.nearestDistance) {
-      if (auto distToShape = shape.nearestTo(referencePoint, manifold)) {
-        best = distToShape;
+  auto todo{GrowableMinHeap<std::pair<double, const geometry::ImmutableBVH3::Node *>, 64>{}};
+  auto boxDistance = [&](const geometry::ImmutableBVH3::Node *node) { return distance(referencePoint, BoundBox3d(node->box).clamp(referencePoint)); };
+  if (!mBVH.nodes.empty()) {
+    auto root{&mBVH.nodes[0]};
+    auto rootDist{boxDistance(root)};
+    if (rootDist < manifold.nearestDistance) todo.push({rootDist, root});
+  }
+  while (!todo.empty()) {
+    auto [nodeDist, node] = todo.pop();
+    if (!(nodeDist < manifold.nearestDistance)) continue;
+    if (node->isBranch()) {
+      for (auto child : {node + 1, node + node->right}) {
+        auto childDist{boxDistance(child)};
+        if (childDist < manifold.nearestDistance) todo.push({childDist, child});
+      }
+    } else {
+      for (uint32_t i = node->first; i < node->first + node->count; i++) {
+        const uint32_t instanceIndex{mInstanceIndexes[i]};
+        const Instance &instance{mInstances[instanceIndex]};
+        // Convert the nearest distance to local space, which is exact only for uniform scale. Otherwise the point
+        // may be farther in world space than the nearest so far, so it must be checked before replacing anything.
+        Manifold localManifold{manifold};
+        localManifold.nearestDistance = manifold.nearestDistance / instance.transform.uniformScale();
+        if (mPrototypes[instance.prototype]->nearestTo(inverse(instance.transform).applyAffine(referencePoint), localManifold)) {
+          localManifold >>= instance.transform;
+          if (double dist{distance(referencePoint, localManifold.point)}; dist < manifold.nearestDistance) {
+            manifold = localManifold;
+            manifold.correct.normal = normalize(manifold.correct.normal);
+            manifold.shading.normal = normalize(manifold.shading.normal);
+            manifold.instanceIndex = instanceIndex;
+            manifold.nearestDistance = dist;
+            best = dist;
+          }
+        }
       }
     }
   }
   return best;
 }
 
+void ShapeInstances::updateInstance(size_t index, const AffineTransform &transform) {
+  if (index >= mInstances.size()) [[unlikely]]
+    throw Error(std::invalid_argument("Call to ShapeInstances::updateInstance() failed! Reason: Index out of range"));
+  mInstances[index].transform = transform;
+}
+
+void ShapeInstances::refit() {
+  for (size_t nodeIndex = mBVH.nodes.size(); nodeIndex-- > 0;) {
+    auto &node{mBVH.nodes[nodeIndex]};
+    if (node.isBranch()) {
+      node.box = (&node + 1)->box;
+      node.box |= (&node + node.right)->box;
+    } else {
+      node.box = {};
+      for (uint32_t i = node.first; i < node.first + node.count; i++) node.box |= conservativeBox(instanceBox(mInstances[mInstanceIndexes[i]]));
+    }
+  }
+  mBox = {};
+  for (const auto &instance : mInstances) mBox |= instanceBox(instance);
+}
+
 } // namespace mi::render
@@ -1,4 +1,5 @@
 #include "Microcosm/Render/Spectrum"
+#include <mutex>
 
 namespace mi::render {
 
@@ -14,15 +15,93 @@ Spectrum spectrumLinspace(size_t count, double minValue, double maxValue, Random
   return values;
 }
 
+namespace {
+
+/// The color matching functions, tabulated at 1nm in structure-of-arrays layout.
+struct ColorMatchingTable {
+  static constexpr double MinWaveLen = 0.36;
+  static constexpr double MaxWaveLen = 0.83;
+  static constexpr int Count = 471;
+  static constexpr double InverseStep = (Count - 1) / (MaxWaveLen - MinWaveLen);
+  float valuesX[Count + 1];
+  float valuesY[Count + 1];
+  float valuesZ[Count + 1];
+  ColorMatchingTable() noexcept {
+    for (int i = 0; i < Count; i++) {
+      double waveLen{MinWaveLen + i / InverseStep};
+      valuesX[i] = wymanFit1931X(waveLen);
+      valuesY[i] = wymanFit1931Y(waveLen);
+      valuesZ[i] = wymanFit1931Z(waveLen);
+    }
+    // Pad the end so that the lerp at the maximum wavelength never reads out of bounds.
+    valuesX[Count] = valuesX[Count - 1];
+    valuesY[Count] = valuesY[Count - 1];
+    valuesZ[Count] = valuesZ[Count - 1];
+  }
+};
+
+const ColorMatchingTable colorMatchingTable{};
+
+} // namespace
+
+Vector3d colorMatchingXYZ(double waveLen) noexcept {
+  const auto &table{colorMatchingTable};
+  double param{(waveLen - table.MinWaveLen) * table.InverseStep};
+  if (!(param >= 0 && param <= table.Count - 1)) return {};
+  int index{int(param)};
+  double fract{param - index};
+  return {
+    lerp(fract, double(table.valuesX[index]), double(table.valuesX[index + 1])), //
+    lerp(fract, double(table.valuesY[index]), double(table.valuesY[index + 1])), //
+    lerp(fract, double(table.valuesZ[index]), double(table.valuesZ[index + 1]))};
+}
+
+// Note: The batch loops below are branch-free so that they vectorize, with the table lookups compiling to gathers.
+
+void colorMatchingXYZ(const Spectrum &waveLens, Spectrum &valuesX, Spectrum &valuesY, Spectrum &valuesZ) noexcept {
+  const auto &table{colorMatchingTable};
+  const size_t count{waveLens.size()};
+  valuesX.resize(count);
+  valuesY.resize(count);
+  valuesZ.resize(count);
+  const double *waveLensPtr{waveLens.data()};
+  double *valuesXPtr{valuesX.data()};
+  double *valuesYPtr{valuesY.data()};
+  double *valuesZPtr{valuesZ.data()};
+#pragma omp simd
+  for (size_t i = 0; i < count; i++) {
+    double param{(waveLensPtr[i] - table.MinWaveLen) * table.InverseStep};
+    double inside{param >= 0 && param <= table.Count - 1 ? 1.0 : 0.0};
+    param = std::clamp(param, 0.0, double(table.Count - 1));
+    int index{int(param)};
+    double fract{param - index};
+    valuesXPtr[i] = inside * (table.valuesX[index] + fract * (table.valuesX[index + 1] - table.valuesX[index]));
+    valuesYPtr[i] = inside * (table.valuesY[index] + fract * (table.valuesY[index + 1] - table.valuesY[index]));
+    valuesZPtr[i] = inside * (table.valuesZ[index] + fract * (table.valuesZ[index + 1] - table.valuesZ[index]));
+  }
+}
+
 Vector3d convertSpectrumToXYZ(const Spectrum &waveLens, const Spectrum &values) noexcept {
   assert(waveLens.size() == values.size());
-  Vector3d colorXYZ{};
-  for (size_t i = 0; i < waveLens.size(); i++) {
-    colorXYZ[0] += wymanFit1931X(waveLens[i]) * values[i];
-    colorXYZ[1] += wymanFit1931Y(waveLens[i]) * values[i];
-    colorXYZ[2] += wymanFit1931Z(waveLens[i]) * values[i];
+  const auto &table{colorMatchingTable};
+  const size_t count{waveLens.size()};
+  const double *waveLensPtr{waveLens.data()};
+  const double *valuesPtr{values.data()};
+  double sumX{0};
+  double sumY{0};
+  double sumZ{0};
+#pragma omp simd reduction(+ : sumX, sumY, sumZ)
+  for (size_t i = 0; i < count; i++) {
+    double param{(waveLensPtr[i] - table.MinWaveLen) * table.InverseStep};
+    double value{param >= 0 && param <= table.Count - 1 ? valuesPtr[i] : 0.0};
+    param = std::clamp(param, 0.0, double(table.Count - 1));
+    int index{int(param)};
+    double fract{param - index};
+    sumX += value * (table.valuesX[index] + fract * (table.valuesX[index + 1] - table.valuesX[index]));
+    sumY += value * (table.valuesY[index] + fract * (table.valuesY[index + 1] - table.valuesY[index]));
+    sumZ += value * (table.valuesZ[index] + fract * (table.valuesZ[index + 1] - table.valuesZ[index]));
   }
-  return colorXYZ / waveLens.size();
+  return Vector3d(sumX, sumY, sumZ) / count;
 }
 
 Vector3d convertSpectrumToRGB(const Spectrum &waveLens, const Spectrum &values) noexcept { return convertXYZToRGB(convertSpectrumToXYZ(waveLens, values)); }
@@ -62,7 +141,31 @@ static constexpr float ConversionCurves[2][7][32] = //
     {+1.0570490f, +1.0538467f, +1.0550494f, +1.0530407f, +1.0579931f, +1.0578439f, +1.0583133f, +1.0579712f, +1.0561885f, +1.0571399f, +1.0425795f, +0.3260309f, -0.0019256f, -0.0012959f, -0.0014357f, -0.0012964f,
      -0.0019227f, +0.0012621f, -0.0016095f, -0.0013030f, -0.0017667f, -0.0012325f, +0.0103168f, +0.0312845f, +0.0887739f, +0.1387362f, +0.1553507f, +0.1487848f, +0.1662426f, +0.1699761f, +0.1576974f, +0.1906909f}}};
 
-Spectrum convertRGBToSpectrumAlbedo(const Spectrum &waveLens, const Vector3d &color) noexcept {
+namespace {
+
+/// The conversion curves, resampled at 1nm with the same Catmull-Rom interpolation as before, so that every
+/// lookup is a direct index and a lerp instead of a search through the irregular knots.
+struct ConversionTable {
+  static constexpr double MinWaveLen = ConversionWaveLens[0];
+  static constexpr double MaxWaveLen = ConversionWaveLens[31];
+  static constexpr int Count = 341;
+  static constexpr double InverseStep = (Count - 1) / (MaxWaveLen - MinWaveLen);
+  float values[2][7][Count];
+  ConversionTable() noexcept {
+    for (int which = 0; which < 2; which++) {
+      for (int curve = 0; curve < 7; curve++) {
+        CubicInterpolator interpolator{&ConversionWaveLens[0], 32};
+        for (int i = 0; i < Count; i++) values[which][curve][i] = interpolator(float(min(MinWaveLen + i / InverseStep, MaxWaveLen)), &ConversionCurves[which][curve][0]);
+      }
+    }
+  }
+};
+
+const ConversionTable conversionTable{};
+
+} // namespace
+
+static Spectrum convertRGBToSpectrum(const Spectrum &waveLens, const Vector3d &color, int which, double multiplier) noexcept {
   Spectrum values{waveLens.shape};
   int orderA = (color[0] <= color[1] && color[0] <= color[2]) ? 0 : (color[1] <= color[2] && color[1] <= color[0]) ? 1 : 2;
   int orderB = (orderA + 1) % 3;
@@ -70,37 +173,196 @@ Spectrum convertRGBToSpectrumAlbedo(const Spectrum &waveLens, const Vector3d &co
   if (!(color[orderB] <= color[orderC])) {
     std::swap(orderB, orderC);
   }
-  CubicInterpolator interpolator{&ConversionWaveLens[0], 32};
+  const auto &curveWhite{conversionTable.values[which][0]};
+  const auto &curveCMY{conversionTable.values[which][orderA + 1]};
+  const auto &curveRGB{conversionTable.values[which][orderC + 4]};
   for (auto &&[waveLen, value] : ranges::zip(waveLens, values)) {
     value = 0;
-    if (waveLen >= ConversionWaveLens[0] && waveLen <= ConversionWaveLens[31]) {
-      value += color[orderA] * interpolator(waveLen, &ConversionCurves[0][0][0]);                            // White
-      value += (color[orderB] - color[orderA]) * interpolator(waveLen, &ConversionCurves[0][orderA + 1][0]); // CMY
-      value += (color[orderC] - color[orderB]) * interpolator(waveLen, &ConversionCurves[0][orderC + 4][0]); // RGB
+    double param{(waveLen - ConversionTable::MinWaveLen) * ConversionTable::InverseStep};
+    if (param >= 0 && param <= ConversionTable::Count - 1) {
+      int index{min(int(param), ConversionTable::Count - 2)};
+      double fract{param - index};
+      value += color[orderA] * lerp(fract, double(curveWhite[index]), double(curveWhite[index + 1]));                // White
+      value += (color[orderB] - color[orderA]) * lerp(fract, double(curveCMY[index]), double(curveCMY[index + 1])); // CMY
+      value += (color[orderC] - color[orderB]) * lerp(fract, double(curveRGB[index]), double(curveRGB[index + 1])); // RGB
     }
-    value *= 0.94;
+    value *= multiplier;
   }
   return values;
 }
 
-Spectrum convertRGBToSpectrumIllumination(const Spectrum &waveLens, const Vector3d &color) noexcept {
-  Spectrum values{waveLens.shape};
-  int orderA = (color[0] <= color[1] && color[0] <= color[2]) ? 0 : (color[1] <= color[2] && color[1] <= color[0]) ? 1 : 2;
-  int orderB = (orderA + 1) % 3;
-  int orderC = (orderA + 2) % 3;
-  if (!(color[orderB] <= color[orderC])) {
-    std::swap(orderB, orderC);
+Spectrum convertRGBToSpectrumAlbedo(const Spectrum &waveLens, const Vector3d &color) noexcept { return convertRGBToSpectrum(waveLens, color, 0, 0.94); }
+
+Spectrum convertRGBToSpectrumIllumination(const Spectrum &waveLens, const Vector3d &color) noexcept { return convertRGBToSpectrum(waveLens, color, 1, 0.86445); }
+
+namespace {
+
+/// The forward model for fitting the sigmoid polynomial coefficients, which is the color of the spectrum as an albedo
+/// under the D65 illuminant, in CIE LAB relative to the sRGB white point. This follows the reference implementation
+/// of Jakob and Hanika, except that the polynomial is in the normalized wavelength rather than in nanometers.
+struct SigmoidFit {
+  static constexpr int Count = 95;
+  double params[Count];
+  Vector3d weights[Count];
+  Vector3d whiteXYZ;
+  SigmoidFit() {
+    Spectrum waveLens{spectrumLinspace(Count, RGBToSpectrumTable::MinWaveLen, RGBToSpectrumTable::MaxWaveLen)};
+    Spectrum illuminant{spectrumIlluminantD65(waveLens)};
+    double sumY{0};
+    for (int i = 0; i < Count; i++) {
+      params[i] = unlerp(waveLens[i], RGBToSpectrumTable::MinWaveLen, RGBToSpectrumTable::MaxWaveLen);
+      weights[i] = colorMatchingXYZ(waveLens[i]) * illuminant[i];
+      sumY += weights[i][1];
+    }
+    for (auto &weight : weights) weight /= sumY;
+    whiteXYZ = convertRGBToXYZ(Vector3d(1, 1, 1));
   }
-  CubicInterpolator interpolator{&ConversionWaveLens[0], 32};
-  for (auto &&[waveLen, value] : ranges::zip(waveLens, values)) {
-    value = 0;
-    if (waveLen >= ConversionWaveLens[0] && waveLen <= ConversionWaveLens[31]) {
-      value += color[orderA] * interpolator(waveLen, &ConversionCurves[0][0][0]);                            // White
-      value += (color[orderB] - color[orderA]) * interpolator(waveLen, &ConversionCurves[0][orderA + 1][0]); // CMY
-      value += (color[orderC] - color[orderB]) * interpolator(waveLen, &ConversionCurves[0][orderC + 4][0]); // RGB
+  [[nodiscard]] Vector3d colorLAB(const Vector3d &coeffs) const noexcept {
+    Vector3d colorXYZ{};
+    for (int i = 0; i < Count; i++) colorXYZ += weights[i] * RGBToSpectrumTable::evaluateNormalized(coeffs, params[i]);
+    return convertXYZToLAB<double>(colorXYZ / whiteXYZ);
+  }
+  void gaussNewton(const Vector3d &color, Vector3d &coeffs, int numIters = 15) const noexcept {
+    Vector3d targetLAB{convertXYZToLAB<double>(convertRGBToXYZ(color) / whiteXYZ)};
+    for (int iter = 0; iter < numIters; iter++) {
+      Vector3d residual{colorLAB(coeffs) - targetLAB};
+      if (dot(residual, residual) < 1e-12) break;
+      Matrix3d jacobian;
+      for (int k = 0; k < 3; k++) {
+        constexpr double Eps = 1e-5;
+        Vector3d coeffsA{coeffs};
+        Vector3d coeffsB{coeffs};
+        coeffsA[k] -= Eps;
+        coeffsB[k] += Eps;
+        jacobian.col(k).assign((colorLAB(coeffsB) - colorLAB(coeffsA)) / (2 * Eps));
+      }
+      Vector3d delta{dot(inverse(jacobian), residual)};
+      if (!(isfinite(delta[0]) && isfinite(delta[1]) && isfinite(delta[2]))) break;
+      coeffs -= delta;
+      // Keep the coefficients bounded, else the optimization may run off to infinity trying to reach the boundary
+      // of the gamut, which the sigmoid only approaches asymptotically.
+      double maxCoeff{max(max(abs(coeffs[0]), abs(coeffs[1])), abs(coeffs[2]))};
+      if (maxCoeff > 200) coeffs *= 200 / maxCoeff;
+    }
+  }
+};
+
+} // namespace
+
+RGBToSpectrumTable::RGBToSpectrumTable(int resolution) : mResolution(resolution) {
+  if (resolution < 2) throw Error(std::invalid_argument("Call to RGBToSpectrumTable() failed! Reason: Resolution must be at least 2"));
+  const SigmoidFit fit;
+  const size_t res{size_t(resolution)};
+  mScales.resize(res);
+  mCoefficients.resize(3 * res * res * res * 3);
+  for (size_t k = 0; k < res; k++) {
+    double scale{k / double(res - 1)};
+    scale = scale * scale * (3 - 2 * scale);
+    scale = scale * scale * (3 - 2 * scale);
+    mScales[k] = scale;
+  }
+  // Fit every entry, starting from a moderate brightness and sweeping up and then down in brightness, which warm
+  // starts each optimization with the coefficients of its neighbor. Starting from zero at the darkest or brightest
+  // entries is much less robust.
+#pragma omp parallel for collapse(2) schedule(dynamic)
+  for (int channel = 0; channel < 3; channel++) {
+    for (int j = 0; j < resolution; j++) {
+      const double y{j / double(res - 1)};
+      for (size_t i = 0; i < res; i++) {
+        const double x{i / double(res - 1)};
+        auto fitAt = [&](size_t k, Vector3d &coeffs) {
+          Vector3d color;
+          color[channel] = mScales[k];
+          color[(channel + 1) % 3] = x * mScales[k];
+          color[(channel + 2) % 3] = y * mScales[k];
+          fit.gaussNewton(color, coeffs);
+          float *entry{&mCoefficients[3 * (((channel * res + k) * res + j) * res + i)]};
+          entry[0] = coeffs[0], entry[1] = coeffs[1], entry[2] = coeffs[2];
+        };
+        const size_t start{res / 5};
+        Vector3d coeffs{};
+        for (size_t k = start; k < res; k++) fitAt(k, coeffs);
+        coeffs = {};
+        for (size_t k = start + 1; k-- > 0;) fitAt(k, coeffs);
+      }
+    }
+  }
+}
+
+namespace {
+
+/// The standard table. The pointer is only ever set once, under the mutex, and never freed.
+std::mutex standardTableMutex;
+std::atomic<const RGBToSpectrumTable *> standardTable{nullptr};
+
+} // namespace
+
+void RGBToSpectrumTable::initializeStandard() {
+  std::lock_guard lock{standardTableMutex};
+  if (!standardTable) standardTable = new RGBToSpectrumTable(DefaultResolution);
+}
+
+void RGBToSpectrumTable::initializeStandard(RGBToSpectrumTable table) {
+  if (table.mResolution < 2) throw Error(std::invalid_argument("Call to RGBToSpectrumTable::initializeStandard() failed! Reason: Table is empty"));
+  std::lock_guard lock{standardTableMutex};
+  if (standardTable) throw Error(std::logic_error("Call to RGBToSpectrumTable::initializeStandard() failed! Reason: Already initialized"));
+  standardTable = new RGBToSpectrumTable(std::move(table));
+}
+
+bool RGBToSpectrumTable::hasStandard() noexcept { return standardTable != nullptr; }
+
+const RGBToSpectrumTable &RGBToSpectrumTable::standard() {
+  const RGBToSpectrumTable *table{standardTable};
+  if (!table) [[unlikely]]
+    throw Error(std::logic_error("Call to RGBToSpectrumTable::standard() failed! Reason: Not initialized, see RGBToSpectrumTable::initializeStandard()"));
+  return *table;
+}
+
+Vector3d RGBToSpectrumTable::coefficients(Vector3d color) const noexcept {
+  for (double &each : color) each = clamp(each, 0.0, 1.0);
+  if (color[0] == color[1] && color[1] == color[2]) {
+    // The sigmoid of a constant is a constant.
+    return {0.0, 0.0, (color[0] - 0.5) / sqrt(color[0] * (1 - color[0]))};
+  }
+  const int res{mResolution};
+  int channel{color[0] > color[1] ? (color[0] > color[2] ? 0 : 2) : (color[1] > color[2] ? 1 : 2)};
+  double z{color[channel]};
+  double x{color[(channel + 1) % 3] * (res - 1) / z};
+  double y{color[(channel + 2) % 3] * (res - 1) / z};
+  int i{min(int(x), res - 2)};
+  int j{min(int(y), res - 2)};
+  int k{clamp(int(std::upper_bound(mScales.begin(), mScales.end(), float(z)) - mScales.begin()) - 1, 0, res - 2)};
+  double fractX{x - i};
+  double fractY{y - j};
+  double fractZ{(z - mScales[k]) / (mScales[k + 1] - mScales[k])};
+  Vector3d coeffs{};
+  for (int cornerZ = 0; cornerZ < 2; cornerZ++) {
+    for (int cornerY = 0; cornerY < 2; cornerY++) {
+      for (int cornerX = 0; cornerX < 2; cornerX++) {
+        double weight{(cornerX ? fractX : 1 - fractX) * (cornerY ? fractY : 1 - fractY) * (cornerZ ? fractZ : 1 - fractZ)};
+        const float *entry{&mCoefficients[3 * (((size_t(channel) * res + (k + cornerZ)) * res + (j + cornerY)) * res + (i + cornerX))]};
+        coeffs[0] += weight * entry[0];
+        coeffs[1] += weight * entry[1];
+        coeffs[2] += weight * entry[2];
+      }
     }
-    value *= 0.86445;
   }
+  return coeffs;
+}
+
+Spectrum RGBToSpectrumTable::albedo(const Spectrum &waveLens, const Vector3d &color) const noexcept {
+  Vector3d coeffs{coefficients(color)};
+  Spectrum values{waveLens.shape};
+  for (auto &&[waveLen, value] : ranges::zip(waveLens, values)) value = evaluate(coeffs, waveLen);
+  return values;
+}
+
+Spectrum RGBToSpectrumTable::illumination(const Spectrum &waveLens, const Vector3d &color) const noexcept {
+  double scale{2 * max(max(color[0], color[1]), color[2])};
+  if (!(scale > 0)) return spectrumZerosLike(waveLens);
+  Spectrum values{albedo(waveLens, color / scale)};
+  values *= spectrumIlluminantD65(waveLens);
+  values *= scale / 100.0;
   return values;
 }
 
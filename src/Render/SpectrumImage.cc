@@ -1,16 +1,21 @@
 #include "Microcosm/Render/SpectrumImage"
+#include "Microcosm/miniz"
+#include <bit>
+#include <cstring>
+#include <exception>
 
 namespace mi::render {
 
-void SpectrumImage::resize(int newNumBands, Vector2i newSize) noexcept {
+void SpectrumImage::resize(int newNumBands, Vector2i newSize, bool tiled) noexcept {
   clear();
   mNumBands = max(0, newNumBands);
   mSizeX = max(0, newSize[0]);
   mSizeY = max(0, newSize[1]);
-  mData = static_cast<std::byte *>(std::malloc(imageSizeInBytes()));
+  mTiled = tiled;
+  mData = static_cast<std::byte *>(std::calloc(numPixelsInStorage(), pixelSizeInBytes()));
 }
 
-void SpectrumImage::clear() noexcept { mSizeX = mSizeY = mNumBands = 0, std::free(mData), mData = nullptr; }
+void SpectrumImage::clear() noexcept { mSizeX = mSizeY = mNumBands = 0, mTiled = false, std::free(mData), mData = nullptr; }
 
 void SpectrumImage::add(Vector2i index, const Spectrum &values, double weight) {
   const char *error = //
@@ -32,6 +37,18 @@ void SpectrumImage::add(Vector2i index, const Spectrum &values, double weight) {
   }
 }
 
+void SpectrumImage::addAccumulated(Vector2i index, uint64_t num, double weight, const double *weightedValues) {
+  if (!isIndexValid(index)) [[unlikely]] {
+    throw Error(std::logic_error("Call to SpectrumImage::addAccumulated() failed! Reason: Invalid index"));
+  }
+  PixelReference pixelRef{pixelReference(index)};
+  pixelRef.num += num;
+  pixelRef.weight += weight;
+  for (int i = 0; i < mNumBands; i++) {
+    pixelRef.values[i] += weightedValues[i];
+  }
+}
+
 Spectrum SpectrumImage::extract(Vector2i index, bool divideOutNum, bool divideOutWeight) {
   if (!isIndexValid(index)) [[unlikely]] {
     throw Error(std::logic_error("Call to SpectrumImage::extract() failed! Reason: Invalid index"));
@@ -48,4 +65,223 @@ Spectrum SpectrumImage::extract(Vector2i index, bool divideOutNum, bool divideOu
   return values;
 }
 
+std::vector<float> SpectrumImage::convertToColor(const ExportOptions &options) {
+  const bool isSpectral{!options.waveLens.empty()};
+  if (isSpectral ? int(options.waveLens.size()) != mNumBands : !(mNumBands == 1 || mNumBands == 3)) [[unlikely]] {
+    throw Error(std::invalid_argument("Call to SpectrumImage::convertToColor() failed! Reason: Inconsistent bands"));
+  }
+  std::vector<float> result(size_t(mSizeX) * size_t(mSizeY) * 3);
+#pragma omp parallel
+  {
+    Spectrum values{with_shape, size_t(mNumBands)};
+#pragma omp for schedule(static)
+    for (int y = 0; y < mSizeY; y++) {
+      for (int x = 0; x < mSizeX; x++) {
+        PixelReference pixelRef{pixelReference({x, y})};
+        for (int i = 0; i < mNumBands; i++) values[i] = pixelRef.values[i].load(std::memory_order_relaxed);
+        auto currentNum{pixelRef.num.load(std::memory_order_relaxed)};
+        auto currentWeight{pixelRef.weight.load(std::memory_order_relaxed)};
+        if (options.divideOutNum && currentNum != 0) values /= currentNum;
+        if (options.divideOutWeight && currentWeight != 0) values /= currentWeight;
+        Vector3d color;
+        if (isSpectral) {
+          color = convertSpectrumToXYZ(options.waveLens, values);
+          if (!options.toXYZ) color = convertXYZToRGB(color);
+        } else {
+          color = mNumBands == 1 ? Vector3d(values[0], values[0], values[0]) : Vector3d(values[0], values[1], values[2]);
+        }
+        float *pixel{&result[(size_t(y) * size_t(mSizeX) + size_t(x)) * 3]};
+        pixel[0] = color[0], pixel[1] = color[1], pixel[2] = color[2];
+      }
+    }
+  }
+  return result;
+}
+
+// Note: Both file formats are written little-endian here, which is native for PFM with a negative scale and mandatory
+// for OpenEXR.
+static_assert(std::endian::native == std::endian::little);
+
+void SpectrumImage::writePFM(std::ostream &stream, const ExportOptions &options) {
+  if (!(mSizeX > 0 && mSizeY > 0)) throw Error(std::invalid_argument("Call to SpectrumImage::writePFM() failed! Reason: Image is empty"));
+  const std::vector<float> color{convertToColor(options)};
+  stream << "PF\n" << mSizeX << ' ' << mSizeY << "\n-1\n";
+  // The scanlines are stored from bottom to top.
+  for (int y = mSizeY - 1; y >= 0; y--) stream.write(reinterpret_cast<const char *>(&color[size_t(y) * size_t(mSizeX) * 3]), std::streamsize(mSizeX) * 3 * sizeof(float));
+  if (!stream) throw Error(std::runtime_error("Call to SpectrumImage::writePFM() failed! Reason: Stream failure"));
+}
+
+void SpectrumImage::writePFM(const std::string &filename, const ExportOptions &options) {
+  auto stream = openOFStreamOrThrow(filename);
+  writePFM(stream, options);
+}
+
+void SpectrumImage::writeEXR(std::ostream &stream, const ExportOptions &options) {
+  // Note: OpenEXR cannot represent an empty data window, and the predictor below assumes non-empty chunks.
+  if (!(mSizeX > 0 && mSizeY > 0)) throw Error(std::invalid_argument("Call to SpectrumImage::writeEXR() failed! Reason: Image is empty"));
+  const std::vector<float> color{convertToColor(options)};
+  const size_t sizeX{size_t(mSizeX)};
+  const size_t channelSize{options.halfPrecision ? sizeof(Half) : sizeof(float)};
+  const int numLinesPerChunk{options.compress ? 16 : 1};
+  const int numChunks{(mSizeY + numLinesPerChunk - 1) / numLinesPerChunk};
+
+  // The channels must be in alphabetical order, which for RGB means blue first.
+  const char *channelNames{options.toXYZ ? "XYZ" : "BGR"};
+  const int channelIndexes[3]{options.toXYZ ? 0 : 2, 1, options.toXYZ ? 2 : 0};
+
+  std::string header;
+  auto put = [&](auto value) { header.append(reinterpret_cast<const char *>(&value), sizeof(value)); };
+  auto putAttribute = [&](const char *name, const char *type, int32_t size) {
+    header.append(name), header.push_back('\0');
+    header.append(type), header.push_back('\0');
+    put(size);
+  };
+  put(int32_t(20000630)); // Magic number
+  put(int32_t(2));        // Version 2, single-part scanline
+  putAttribute("channels", "chlist", 3 * 18 + 1);
+  for (int c = 0; c < 3; c++) {
+    header.push_back(channelNames[c]), header.push_back('\0');
+    put(int32_t(options.halfPrecision ? 1 : 2)); // Pixel type
+    put(uint32_t(0));                            // Linear flag and reserved bytes
+    put(int32_t(1));                             // Sampling in X
+    put(int32_t(1));                             // Sampling in Y
+  }
+  header.push_back('\0');
+  putAttribute("compression", "compression", 1);
+  put(uint8_t(options.compress ? 3 : 0)); // ZIP or none
+  for (const char *name : {"dataWindow", "displayWindow"}) {
+    putAttribute(name, "box2i", 16);
+    put(int32_t(0)), put(int32_t(0)), put(int32_t(mSizeX - 1)), put(int32_t(mSizeY - 1));
+  }
+  putAttribute("lineOrder", "lineOrder", 1);
+  put(uint8_t(0)); // Increasing Y
+  putAttribute("pixelAspectRatio", "float", 4);
+  put(1.0f);
+  putAttribute("screenWindowCenter", "v2f", 8);
+  put(0.0f), put(0.0f);
+  putAttribute("screenWindowWidth", "float", 4);
+  put(1.0f);
+  header.push_back('\0');
+
+  // Note: Exceptions must not escape the parallel region, so the first one is captured and rethrown afterwards.
+  std::vector<miniz::Bytes> chunks(numChunks);
+  std::exception_ptr exception;
+#pragma omp parallel
+  {
+    miniz::Bytes rawBytes;
+    miniz::Bytes predictedBytes;
+#pragma omp for schedule(dynamic)
+    for (int chunkIndex = 0; chunkIndex < numChunks; chunkIndex++) try {
+      const int minY{chunkIndex * numLinesPerChunk};
+      const int maxY{min(minY + numLinesPerChunk, mSizeY)};
+      rawBytes.resize(size_t(maxY - minY) * sizeX * 3 * channelSize);
+      std::byte *rawPtr{rawBytes.data()};
+      for (int y = minY; y < maxY; y++) {
+        for (int c = 0; c < 3; c++) {
+          const float *values{&color[size_t(y) * sizeX * 3 + size_t(channelIndexes[c])]};
+          for (size_t x = 0; x < sizeX; x++) {
+            if (options.halfPrecision) {
+              uint16_t bits{std::bit_cast<uint16_t>(Half(values[3 * x]))};
+              std::memcpy(rawPtr, &bits, sizeof(bits));
+            } else {
+              std::memcpy(rawPtr, &values[3 * x], sizeof(float));
+            }
+            rawPtr += channelSize;
+          }
+        }
+      }
+      miniz::Bytes &chunk{chunks[chunkIndex]};
+      if (options.compress) {
+        // Split the even and odd bytes, then take differences, as OpenEXR expects before the zlib compression.
+        const size_t numBytes{rawBytes.size()};
+        predictedBytes.resize(numBytes);
+        for (size_t i = 0; i < numBytes; i++) predictedBytes[(i & 1) ? (numBytes + 1) / 2 + i / 2 : i / 2] = rawBytes[i];
+        for (size_t i = numBytes - 1; i > 0; i--) predictedBytes[i] = std::byte(uint8_t(int(predictedBytes[i]) - int(predictedBytes[i - 1]) + 128));
+        chunk = miniz::deflate(predictedBytes);
+        // If compression does not help, OpenEXR expects the raw bytes, which it recognizes by the size.
+        if (chunk.size() >= numBytes) chunk = rawBytes;
+      } else {
+        chunk = rawBytes;
+      }
+    } catch (...) {
+#pragma omp critical
+      if (!exception) exception = std::current_exception();
+    }
+  }
+  if (exception) std::rethrow_exception(exception);
+
+  // The offset table holds the position of every chunk in the file, where every chunk is preceded by the index of
+  // its first scanline and its size in bytes.
+  std::vector<uint64_t> offsets(numChunks);
+  uint64_t offset{header.size() + offsets.size() * sizeof(uint64_t)};
+  for (int chunkIndex = 0; chunkIndex < numChunks; chunkIndex++) {
+    offsets[chunkIndex] = offset;
+    offset += 2 * sizeof(int32_t) + chunks[chunkIndex].size();
+  }
+  stream.write(header.data(), std::streamsize(header.size()));
+  stream.write(reinterpret_cast<const char *>(offsets.data()), std::streamsize(offsets.size() * sizeof(uint64_t)));
+  for (int chunkIndex = 0; chunkIndex < numChunks; chunkIndex++) {
+    int32_t chunkHeader[2]{chunkIndex * numLinesPerChunk, int32_t(chunks[chunkIndex].size())};
+    stream.write(reinterpret_cast<const char *>(&chunkHeader[0]), sizeof(chunkHeader));
+    stream.write(reinterpret_cast<const char *>(chunks[chunkIndex].data()), std::streamsize(chunks[chunkIndex].size()));
+  }
+  if (!stream) throw Error(std::runtime_error("Call to SpectrumImage::writeEXR() failed! Reason: Stream failure"));
+}
+
+void SpectrumImage::writeEXR(const std::string &filename, const ExportOptions &options) {
+  auto stream = openOFStreamOrThrow(filename);
+  writeEXR(stream, options);
+}
+
+SpectrumImageAccumulator::SpectrumImageAccumulator(SpectrumImage &image, size_t maxTiles)
+  : mImage(&image), mPixelSize(size_t(image.numBands()) + 2), mMaxTiles(max(maxTiles, size_t(1))), mSlots(size_t(image.numTilesX()) * size_t(image.numTilesY()), NoSlot) {}
+
+void SpectrumImageAccumulator::add(Vector2i index, const Spectrum &values, double weight) {
+  const char *error = //
+    !mImage                           ? "No image"
+    : values.size() != mPixelSize - 2 ? "Inconsistent bands"
+    : !allTrue(isfinite(values))      ? "Non-finite spectrum values"
+    : !isfinite(weight)               ? "Non-finite spectrum weight"
+    : !mImage->isIndexValid(index)    ? "Invalid index"
+                                      : nullptr;
+  if (error) [[unlikely]] {
+    throw Error(std::logic_error("Call to SpectrumImageAccumulator::add() failed! Reason: {}"_format(error)));
+  }
+  constexpr int TileSize{SpectrumImage::TileSize};
+  const size_t tile{size_t(index[1] / TileSize) * size_t(mImage->numTilesX()) + size_t(index[0] / TileSize)};
+  uint32_t &slot{mSlots[tile]};
+  if (slot == NoSlot) [[unlikely]] {
+    if (mSlotTiles.size() == mMaxTiles) merge();
+    slot = uint32_t(mSlotTiles.size());
+    mSlotTiles.push_back(uint32_t(tile));
+    mValues.resize(mSlotTiles.size() * TileSize * TileSize * mPixelSize, 0.0);
+  }
+  double *pixelValues{&mValues[((size_t(slot) * TileSize + size_t(index[1] % TileSize)) * TileSize + size_t(index[0] % TileSize)) * mPixelSize]};
+  pixelValues[0] += 1;
+  pixelValues[1] += weight;
+  if (weight != 0) [[likely]] {
+    for (size_t i = 0; i + 2 < mPixelSize; i++) {
+      pixelValues[i + 2] += weight * values[i];
+    }
+  }
+}
+
+void SpectrumImageAccumulator::merge() {
+  constexpr int TileSize{SpectrumImage::TileSize};
+  for (size_t slot = 0; slot < mSlotTiles.size(); slot++) {
+    const int tileX{int(mSlotTiles[slot] % uint32_t(mImage->numTilesX())) * TileSize};
+    const int tileY{int(mSlotTiles[slot] / uint32_t(mImage->numTilesX())) * TileSize};
+    for (int y = 0; y < TileSize; y++) {
+      for (int x = 0; x < TileSize; x++) {
+        const double *pixelValues{&mValues[((slot * TileSize + size_t(y)) * TileSize + size_t(x)) * mPixelSize]};
+        if (pixelValues[0] > 0) mImage->addAccumulated({tileX + x, tileY + y}, uint64_t(pixelValues[0]), pixelValues[1], pixelValues + 2);
+      }
+    }
+    mSlots[mSlotTiles[slot]] = NoSlot;
+  }
+  // Keep the allocation around for the next batch of tiles.
+  mSlotTiles.clear();
+  mValues.clear();
+}
+
 } // namespace mi::render
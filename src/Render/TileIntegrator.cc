@@ -0,0 +1,79 @@
+#include "Microcosm/Render/TileIntegrator"
+#include <exception>
+#include <omp.h>
+
+namespace mi::render {
+
+std::vector<TileIntegrator::Tile> TileIntegrator::tiles(Vector2i imageSize) const {
+  std::vector<Tile> result;
+  Vector2i tileSize{max(mOptions.tileSize[0], 1), max(mOptions.tileSize[1], 1)};
+  for (int y = 0; y < imageSize[1]; y += tileSize[1]) {
+    for (int x = 0; x < imageSize[0]; x += tileSize[0]) {
+      Tile &tile{result.emplace_back()};
+      tile.index = result.size() - 1;
+      tile.lower = {x, y};
+      tile.upper = {min(x + tileSize[0], imageSize[0]), min(y + tileSize[1], imageSize[1])};
+    }
+  }
+  return result;
+}
+
+void TileIntegrator::operator()(SpectrumImage &image, const PixelSampler &pixelSampler) const {
+  const bool printProgress{mOptions.printProgress};
+  const size_t seed{mOptions.seed};
+  const size_t numSamplesPerPixel{mOptions.numSamplesPerPixel};
+  const size_t numBands{size_t(image.numBands())};
+  const std::vector<Tile> allTiles{tiles({image.sizeX(), image.sizeY()})};
+  const ptrdiff_t numTiles{ptrdiff_t(allTiles.size())};
+
+  std::vector<Worker> workers(omp_get_max_threads());
+  for (size_t workerIndex = 0; workerIndex < workers.size(); workerIndex++) workers[workerIndex].index = workerIndex;
+
+  std::optional<Progress> progress;
+  if (printProgress) progress.emplace("Rendering", allTiles.size());
+
+  // Note: Exceptions must not escape the parallel region, so the first one is captured and rethrown afterwards.
+  std::exception_ptr exception;
+#pragma omp parallel
+  {
+    Worker &worker{workers[omp_get_thread_num()]};
+
+    // The tile-local accumulation buffers, reused for every tile this thread processes. For each pixel, this
+    // holds the weight followed by the weighted values of each band, the same way the image does.
+    std::vector<double> tileValues;
+#pragma omp for schedule(dynamic, 1)
+    for (ptrdiff_t tileIndex = 0; tileIndex < numTiles; tileIndex++) try {
+      const Tile &tile{allTiles[tileIndex]};
+      const Vector2i tileExtent{tile.upper - tile.lower};
+      tileValues.assign(size_t(tileExtent.product()) * (numBands + 1), 0.0);
+      worker.random = Random(Pcg32(seed, tile.index));
+      for (int y = tile.lower[1]; y < tile.upper[1]; y++) {
+        for (int x = tile.lower[0]; x < tile.upper[0]; x++) {
+          double *pixelValues{&tileValues[size_t((y - tile.lower[1]) * tileExtent[0] + (x - tile.lower[0])) * (numBands + 1)]};
+          for (size_t sampleIndex = 0; sampleIndex < numSamplesPerPixel; sampleIndex++) {
+            Spectrum values{pixelSampler(worker, Vector2d(x, y) + worker.random.generate2())};
+            if (values.size() != numBands) [[unlikely]]
+              throw Error(std::logic_error("Call to TileIntegrator::operator()() failed! Reason: Inconsistent bands"));
+            if (!allTrue(isfinite(values))) [[unlikely]]
+              continue;
+            pixelValues[0] += 1;
+            for (size_t i = 0; i < numBands; i++) pixelValues[i + 1] += values[i];
+          }
+        }
+      }
+      for (int y = tile.lower[1]; y < tile.upper[1]; y++) {
+        for (int x = tile.lower[0]; x < tile.upper[0]; x++) {
+          const double *pixelValues{&tileValues[size_t((y - tile.lower[1]) * tileExtent[0] + (x - tile.lower[0])) * (numBands + 1)]};
+          image.addAccumulated({x, y}, numSamplesPerPixel, pixelValues[0], pixelValues + 1);
+        }
+      }
+      if (progress) progress->increment();
+    } catch (...) {
+#pragma omp critical
+      if (!exception) exception = std::current_exception();
+    }
+  }
+  if (exception) std::rethrow_exception(exception);
+}
+
+} // namespace mi::render
@@ -0,0 +1,82 @@
+#include "Microcosm/Render/VCM"
+#include <exception>
+#include <omp.h>
+
+namespace mi::render {
+
+void VertexMerger::build(std::vector<Path> pathsFromLight, double radius) {
+  if (!(radius > 0)) [[unlikely]]
+    throw Error(std::invalid_argument("Call to VertexMerger::build() failed! Reason: Radius must be positive!"));
+  mPathsFromLight = std::move(pathsFromLight);
+  mRadius = radius;
+  mConnector.setMergeFactor(constants::Pi<double> * radius * radius * double(max(mPathsFromLight.size(), size_t(1))));
+  mVertexIndexes.clear();
+  geometry::ImmutableKDTree3::Items items;
+  for (size_t pathIndex = 0; pathIndex < mPathsFromLight.size(); pathIndex++) {
+    Path &path{mPathsFromLight[pathIndex]};
+    mConnector.accumulatePartialWeights(PathView(path.begin(), path.end()));
+    for (ptrdiff_t vertexIndex = 0; vertexIndex < ptrdiff_t(path.size()); vertexIndex++) {
+      if (!PathConnector::isMergeable(path[vertexIndex], vertexIndex)) continue;
+      items.push_back({uint32_t(mVertexIndexes.size()), Vector3f(path[vertexIndex].position)});
+      mVertexIndexes.emplace_back(uint32_t(pathIndex), uint32_t(vertexIndex));
+    }
+  }
+  mKDTree.clear();
+  if (!items.empty()) mKDTree.build(items);
+}
+
+void VertexMerger::merge(Random &random, PathView pathFromCamera, const PathConnector::Receiver &receiver) const {
+  if (mKDTree.nodes.empty()) return;
+  mConnector.accumulatePartialWeights(pathFromCamera);
+  for (ptrdiff_t vertexIndex = 1; vertexIndex < pathFromCamera.size(); vertexIndex++) {
+    const Path::Vertex &vertex{pathFromCamera[vertexIndex]};
+    if (!PathConnector::isMergeable(vertex, vertexIndex)) continue;
+    PathView pathA{&pathFromCamera[0], size_t(vertexIndex + 1)};
+    mKDTree.visit(Vector3f(vertex.position), float(mRadius), [&](const auto &node) {
+      const auto [pathIndex, otherIndex] = mVertexIndexes[node.index];
+      const Path::Vertex *pathB{&mPathsFromLight[pathIndex][0]};
+      // Reject merges across the surface, e.g., with the other side of a thin wall.
+      if (dot(vertex.correctNormal(), pathB[otherIndex].correctNormal()) > 0) mConnector.merge(random, pathA, ConstPathView(pathB, otherIndex + 1), receiver);
+      return true;
+    });
+  }
+}
+
+void VCMIntegrator::operator()(SpectrumImage &image, const PathConnector &connector, const LightPathSampler &lightPathSampler, const PixelSampler &pixelSampler) const {
+  const size_t seed{mOptions.seed};
+  const size_t numIterations{mOptions.numIterations};
+  const size_t numPixels{size_t(image.sizeX()) * size_t(image.sizeY())};
+  const size_t numPathsFromLight{mOptions.numPathsFromLight > 0 ? mOptions.numPathsFromLight : numPixels};
+  if (numPathsFromLight == 0) return;
+
+  VertexMerger merger{connector};
+  std::optional<Progress> progress;
+  if (mOptions.printProgress) progress.emplace("Rendering", numIterations);
+  for (size_t iteration = 0; iteration < numIterations; iteration++) {
+    const size_t iterationSeed{seed ^ (0x9E3779B97F4A7C15ULL * (iteration + 1))};
+    std::vector<Path> pathsFromLight(numPathsFromLight);
+    // Note: As in the TileIntegrator, rethrow the first exception from the light path sampler outside the parallel region.
+    std::exception_ptr exception;
+#pragma omp parallel for schedule(dynamic, 64)
+    for (size_t pathIndex = 0; pathIndex < numPathsFromLight; pathIndex++) try {
+      Random random{Pcg32(iterationSeed, pathIndex)};
+      lightPathSampler(random, pathsFromLight[pathIndex]);
+    } catch (...) {
+#pragma omp critical
+      if (!exception) exception = std::current_exception();
+    }
+    if (exception) std::rethrow_exception(exception);
+    merger.build(std::move(pathsFromLight), radius(iteration));
+    TileIntegrator tileIntegrator{TileIntegrator::Options{.printProgress = false, .seed = iterationSeed ^ 0xC2B2AE3D27D4EB4FULL, .tileSize = mOptions.tileSize, .numSamplesPerPixel = 1}};
+    tileIntegrator(image, [&](TileIntegrator::Worker &worker, Vector2d pixelCoordinate) {
+      // Pair every pixel with one light path, copying into the worker storage so that the pixel sampler is free to
+      // connect with it (which temporarily modifies it) while the other threads merge with the original.
+      const size_t pixelIndex{size_t(floor(pixelCoordinate[1])) * size_t(image.sizeX()) + size_t(floor(pixelCoordinate[0]))};
+      worker.pathFromLight = merger.pathsFromLight()[pixelIndex % numPathsFromLight];
+      return pixelSampler(worker, pixelCoordinate, merger);
+    });
+    if (progress) progress->increment();
+  }
+}
+
+} // namespace mi::render
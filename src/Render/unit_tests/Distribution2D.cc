@@ -0,0 +1,57 @@
+#include "Microcosm/Render/Distribution2D"
+#include "testing.h"
+
+TEST_CASE_TEMPLATE("Distribution2D", Distribution, mi::render::PiecewiseConstant2D, mi::render::HierarchicalWarp2D) {
+  auto prng = PRNG();
+  // Include counts that are not powers of two, which the hierarchical warp pads with zero weight.
+  for (mi::Vector2i count : {mi::Vector2i(8, 4), mi::Vector2i(7, 5), mi::Vector2i(13, 1), mi::Vector2i(1, 6), mi::Vector2i(3, 3)}) {
+    std::vector<double> weights(size_t(count[0]) * size_t(count[1]));
+    for (auto &weight : weights) weight = mi::randomize<double>(prng) < 0.2 ? 0.0 : 0.1 + mi::randomize<double>(prng);
+    weights[prng() % weights.size()] = 1; // Guarantee some positive weight.
+    Distribution distribution{count, weights};
+    CHECK(mi::allTrue(distribution.count() == count));
+    double weightSum{0};
+    for (double weight : weights) weightSum += weight;
+    CHECK(distribution.integral() == Approx(weightSum / (double(count[0]) * double(count[1]))).epsilon(1e-12));
+    auto cellOf = [&](mi::Vector2d point) {
+      int i{std::min(int(point[0] * count[0]), count[0] - 1)};
+      int j{std::min(int(point[1] * count[1]), count[1] - 1)};
+      return size_t(j) * size_t(count[0]) + size_t(i);
+    };
+    SUBCASE("Inverse of sample") {
+      for (int k = 0; k < 2000; k++) {
+        mi::Vector2d sampleU{mi::randomize<mi::Vector2d>(prng)};
+        mi::Vector2d point{distribution.distributionSample(sampleU)};
+        INFO("sampleU = ", sampleU, ", point = ", point);
+        REQUIRE(mi::allTrue((0 <= point) & (point < 1)));
+        CHECK(weights[cellOf(point)] > 0);
+        CHECK(mi::allTrue(mi::abs(distribution.inverse(point) - sampleU) < 1e-9));
+      }
+    }
+    SUBCASE("PDF is normalized") {
+      // The PDF is constant over every cell, so the integral is the average of the PDF at the cell centers.
+      double pdfSum{0};
+      for (int j = 0; j < count[1]; j++) {
+        for (int i = 0; i < count[0]; i++) {
+          double pdf{distribution.distributionPDF(mi::Vector2d((i + 0.5) / count[0], (j + 0.5) / count[1]))};
+          CHECK_MESSAGE(pdf == Approx(weights[size_t(j) * size_t(count[0]) + size_t(i)] / distribution.integral()).epsilon(1e-9), "i = ", i, ", j = ", j);
+          pdfSum += pdf;
+        }
+      }
+      CHECK(pdfSum / (double(count[0]) * double(count[1])) == Approx(1.0).epsilon(1e-9));
+      CHECK(distribution.distributionPDF(mi::Vector2d(-0.1, 0.5)) == 0);
+      CHECK(distribution.distributionPDF(mi::Vector2d(0.5, 1.0)) == 0);
+    }
+    SUBCASE("Sample frequencies match PDF") {
+      constexpr int numSamples{100000};
+      std::vector<int> counts(weights.size());
+      for (int k = 0; k < numSamples; k++) counts[cellOf(distribution(prng))]++;
+      for (size_t cell = 0; cell < weights.size(); cell++) {
+        double prob{weights[cell] / weightSum};
+        double frequency{double(counts[cell]) / numSamples};
+        // Allow five standard deviations of the binomial distribution, so that this does not fail by chance.
+        CHECK_MESSAGE(std::abs(frequency - prob) <= 5 * std::sqrt(prob * (1 - prob) / numSamples) + 1e-4, "cell = ", cell, ", frequency = ", frequency, ", prob = ", prob);
+      }
+    }
+  }
+}
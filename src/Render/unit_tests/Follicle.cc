@@ -0,0 +1,135 @@
+#include "Microcosm/Render/More/Shape/FollicleMesh"
+#include "testing.h"
+
+TEST_CASE("Follicle") {
+  mi::render::Follicle straight{.kind = mi::render::Follicle::Kind::Tube, .radiusA = 0.1, .radiusB = 0.1};
+  straight.curve = mi::Bezier3d<3>(mi::Vector3d(-1, 0, 0), mi::Vector3d(-0.3, 0, 0), mi::Vector3d(0.3, 0, 0), mi::Vector3d(1, 0, 0));
+  SUBCASE("Bounding box includes the full radius") {
+    mi::BoundBox3d box{straight.box()};
+    CHECK(box[0][1] <= -0.1);
+    CHECK(box[1][1] >= +0.1);
+    CHECK(box[0][2] <= -0.1);
+    CHECK(box[1][2] >= +0.1);
+  }
+  SUBCASE("Intersect hits from the front") {
+    mi::render::Manifold manifold;
+    auto param{straight.intersect(mi::Ray3d(mi::Vector3d(0.2, 0, 5), mi::Vector3d(0, 0, -1)), manifold)};
+    REQUIRE(param.has_value());
+    CHECK(*param == Approx(4.9));
+    CHECK(manifold.point[2] == Approx(0.1));
+    CHECK(manifold.correct.normal[2] == Approx(1.0));
+  }
+  SUBCASE("Intersect misses") {
+    mi::render::Manifold manifold;
+    CHECK(!straight.intersect(mi::Ray3d(mi::Vector3d(0.2, 0.5, 5), mi::Vector3d(0, 0, -1)), manifold));
+    CHECK(!straight.intersect(mi::Ray3d(mi::Vector3d(0.2, 0, 5), mi::Vector3d(0, 0, +1)), manifold));
+    CHECK(!straight.intersect(mi::Ray3d(mi::Vector3d(0.2, 0, 5), mi::Vector3d(0, 0, -1), 0, 4), manifold));
+    // The bounding box overlaps the Z-axis, but the curve does not.
+    mi::render::Follicle diagonal{straight};
+    diagonal.curve = mi::Bezier3d<3>(mi::Vector3d(-1, -0.5, 2), mi::Vector3d(-0.3, 0.2, 2), mi::Vector3d(0.3, 0.8, 2), mi::Vector3d(1, 1.5, 2));
+    CHECK(!diagonal.intersectWithZAxis(0, 10, manifold));
+  }
+}
+
+TEST_CASE("FollicleMesh") {
+  auto prng = PRNG();
+  auto randomFollicles = [&](mi::render::Follicle::Kind kind) {
+    std::vector<mi::render::Follicle> follicles;
+    for (int i = 0; i < 200; i++) {
+      mi::Vector3d root{mi::randomize<mi::Vector3d>(prng) * 4.0 - 2.0};
+      mi::Vector3d points[4]{root};
+      for (int k = 1; k < 4; k++) points[k] = points[k - 1] + (mi::randomize<mi::Vector3d>(prng) - 0.5) * 0.6;
+      mi::render::Follicle follicle{.kind = kind, .radiusA = 0.02 + 0.03 * mi::randomize<double>(prng), .radiusB = 0.01};
+      follicle.curve = mi::Bezier3d<3>(points[0], points[1], points[2], points[3]);
+      follicles.push_back(follicle);
+    }
+    return follicles;
+  };
+  auto randomRay = [&] {
+    mi::Vector3d origin{mi::randomize<mi::Vector3d>(prng) * 8.0 - 4.0};
+    mi::Vector3d target{mi::randomize<mi::Vector3d>(prng) * 4.0 - 2.0};
+    return mi::Ray3d(origin, normalize(target - origin));
+  };
+  for (auto kind : {mi::render::Follicle::Kind::Flat, mi::render::Follicle::Kind::Tube}) {
+    // Note: Compare to the follicles as stored in the mesh, since the mesh stores single precision.
+    mi::render::FollicleMesh mesh{randomFollicles(kind)};
+    std::vector<mi::render::Follicle> follicles;
+    for (size_t i = 0; i < mesh.numCurves(); i++) follicles.push_back(mesh.follicle(i));
+    CHECK(mesh.numSegments() >= mesh.numCurves());
+    SUBCASE("Intersect matches brute force with one segment per curve") {
+      mi::render::FollicleMesh meshOneSegment{follicles, {.numSegments = 1}};
+      int numHits{0};
+      for (int k = 0; k < 2000; k++) {
+        mi::Ray3d ray{randomRay()};
+        mi::render::Manifold manifoldA;
+        mi::render::Manifold manifoldB;
+        std::optional<double> paramA{meshOneSegment.intersect(ray, manifoldA)};
+        std::optional<double> paramB{};
+        size_t curveIndex{};
+        for (size_t i = 0; i < follicles.size(); i++) {
+          if (auto param = follicles[i].intersect(ray, manifoldB)) ray.maxParam = *param, paramB = param, curveIndex = i;
+        }
+        CHECK(paramA.has_value() == paramB.has_value());
+        if (paramA && paramB) {
+          numHits++;
+          CHECK(*paramA == Approx(*paramB));
+          CHECK(manifoldA.primitiveIndex == curveIndex);
+          CHECK(mi::allTrue(mi::abs(manifoldA.point - manifoldB.point) < 1e-6));
+        }
+      }
+      CHECK(numHits > 20);
+    }
+    SUBCASE("Intersect with segments agrees with brute force") {
+      // The whole curve only tests the point nearest to the ray in projection, and both place the hit by that point,
+      // so the segments and the whole curve do not always agree. They must agree for the vast majority of rays, and
+      // every hit on a tube must be on the surface of the tube around the curve.
+      int numAgree{0};
+      for (int k = 0; k < 2000; k++) {
+        mi::Ray3d ray{randomRay()};
+        mi::render::Manifold manifoldA;
+        mi::render::Manifold manifoldB;
+        std::optional<double> paramA{mesh.intersect(ray, manifoldA)};
+        std::optional<double> paramB{};
+        for (size_t i = 0; i < follicles.size(); i++) {
+          if (auto param = follicles[i].intersect(ray, manifoldB)) ray.maxParam = *param, paramB = param;
+        }
+        if (paramA && kind == mi::render::Follicle::Kind::Tube) {
+          const mi::render::Follicle &follicle{follicles[manifoldA.primitiveIndex]};
+          double param{manifoldA.correct.parameters[0]};
+          double radius{mi::lerp(param, follicle.radiusA, follicle.radiusB)};
+          CHECK(mi::distance(manifoldA.point, follicle.curve.nearestTo(manifoldA.point).point) < radius * 1.01 + 1e-6);
+        }
+        numAgree += paramA.has_value() == paramB.has_value() && (!paramA || std::abs(*paramA - *paramB) < 2e-2 * *paramB);
+      }
+      CHECK(numAgree > 1950);
+    }
+    SUBCASE("Nearest point matches brute force") {
+      // Every segment contributes the point on the tube at the point on the segment nearest to the reference point,
+      // so the result is bounded above by the same for the whole curve, and bounded below by the exact distance to
+      // the tube, if the radius varies. Note: Search the curves densely here, since Bezier::nearestTo() may settle for
+      // a local minimum.
+      for (int k = 0; k < 100; k++) {
+        mi::Vector3d referencePoint{mi::randomize<mi::Vector3d>(prng) * 6.0 - 3.0};
+        mi::render::Manifold manifold;
+        auto dist{mesh.nearestTo(referencePoint, manifold)};
+        double lowerDist{mi::constants::Inf<double>};
+        double upperDist{mi::constants::Inf<double>};
+        for (const auto &follicle : follicles) {
+          double bestDistToCurve{mi::constants::Inf<double>};
+          double bestParam{0};
+          for (int j = 0; j <= 1000; j++) {
+            double param{j / 1000.0};
+            double distToCurve{mi::distance(referencePoint, follicle.curve(param))};
+            if (distToCurve < bestDistToCurve) bestDistToCurve = distToCurve, bestParam = param;
+            lowerDist = std::min(lowerDist, std::abs(distToCurve - mi::lerp(param, follicle.radiusA, follicle.radiusB)));
+          }
+          upperDist = std::min(upperDist, std::abs(bestDistToCurve - mi::lerp(bestParam, follicle.radiusA, follicle.radiusB)));
+        }
+        REQUIRE(dist.has_value());
+        CHECK(*dist > lowerDist - 1e-4);
+        CHECK(*dist < upperDist + 1e-4);
+        CHECK(*dist == Approx(mi::distance(referencePoint, manifold.point)).epsilon(1e-6));
+      }
+    }
+  }
+}
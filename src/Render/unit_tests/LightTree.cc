@@ -0,0 +1,66 @@
+#include "Microcosm/Render/LightTree"
+#include "testing.h"
+
+TEST_CASE("LightTree") {
+  auto prng = PRNG();
+  std::vector<mi::render::LightTree::Emitter> emitters;
+  for (int i = 0; i < 100; i++) {
+    mi::Vector3d point{mi::randomize<mi::Vector3d>(prng) * 10.0 - 5.0};
+    double power{i % 10 == 0 ? 0.0 : 0.1 + mi::randomize<double>(prng)};
+    if (i % 3 == 0) {
+      emitters.push_back(mi::render::LightTree::Emitter::point(point, power));
+    } else {
+      mi::Vector3d point1{point + mi::randomize<mi::Vector3d>(prng) - 0.5};
+      mi::Vector3d point2{point + mi::randomize<mi::Vector3d>(prng) - 0.5};
+      emitters.push_back(mi::render::LightTree::Emitter::triangle(point, point1, point2, power, i % 3 == 1));
+    }
+  }
+  auto randomNormal = [&] {
+    // Leave the normal out for a quarter of the reference points, as for volumes.
+    return mi::randomize<double>(prng) < 0.25 ? mi::Vector3d() : mi::render::uniformSphereSample(mi::randomize<mi::Vector2d>(prng));
+  };
+  for (int leafLimit : {1, 4}) {
+    mi::render::LightTree lightTree{emitters, {.leafLimit = leafLimit}};
+    CHECK(lightTree.numEmitters() == emitters.size());
+    SUBCASE("Probability matches sample") {
+      for (int k = 0; k < 200; k++) {
+        mi::Vector3d point{mi::randomize<mi::Vector3d>(prng) * 14.0 - 7.0};
+        mi::Vector3d normal{randomNormal()};
+        INFO("point = ", point, ", normal = ", normal);
+        double probSum{0};
+        for (size_t i = 0; i < emitters.size(); i++) {
+          double prob{lightTree.probability(i, point, normal)};
+          probSum += prob;
+          if (!(emitters[i].power > 0)) CHECK_MESSAGE(prob == 0, "i = ", i);
+        }
+        // Note: Sampling gives up where the estimates of both children of a node are zero, so the probabilities may
+        // sum to less than one.
+        CHECK(probSum < 1 + 1e-9);
+        for (int j = 0; j < 10; j++) {
+          if (auto sample = lightTree.sample(mi::randomize<double>(prng), point, normal)) {
+            CHECK(sample->second > 0);
+            CHECK(lightTree.probability(sample->first, point, normal) == Approx(sample->second).epsilon(1e-9));
+          }
+        }
+      }
+      CHECK(lightTree.probability(emitters.size(), mi::Vector3d(), mi::Vector3d()) == 0);
+    }
+    SUBCASE("Sample frequencies match probability") {
+      for (int k = 0; k < 4; k++) {
+        mi::Vector3d point{mi::randomize<mi::Vector3d>(prng) * 14.0 - 7.0};
+        mi::Vector3d normal{randomNormal()};
+        constexpr int numSamples{100000};
+        std::vector<int> counts(emitters.size());
+        for (int j = 0; j < numSamples; j++) {
+          if (auto sample = lightTree.sample(mi::randomize<double>(prng), point, normal)) counts[sample->first]++;
+        }
+        for (size_t i = 0; i < emitters.size(); i++) {
+          double prob{lightTree.probability(i, point, normal)};
+          double frequency{double(counts[i]) / numSamples};
+          // Allow five standard deviations of the binomial distribution, so that this does not fail by chance.
+          CHECK_MESSAGE(std::abs(frequency - prob) <= 5 * std::sqrt(prob * (1 - prob) / numSamples) + 1e-4, "i = ", i, ", frequency = ", frequency, ", prob = ", prob);
+        }
+      }
+    }
+  }
+}
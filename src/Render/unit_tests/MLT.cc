@@ -0,0 +1,47 @@
+#include "Microcosm/Render/MLT"
+#include "testing.h"
+
+TEST_CASE("PSMLTIntegrator") {
+  SUBCASE("Replica exchange does not bias the image") {
+    // Two numbers of bounces with similar integrals, where the tempered integrals differ by orders of magnitude. The
+    // paths with no bounces land in pixel 0 with constant intensity, and the paths with one bounce land in pixel 1
+    // with all of the intensity concentrated in a small fraction of primary sample space.
+    auto randomSampler = [](mi::render::Random &random, size_t depthFromCamera, size_t depthFromLight) {
+      mi::render::PSMLTIntegrator::Contribution contribution;
+      for (size_t i = 0; i < depthFromCamera; i++) contribution.subpathFromCamera.push({});
+      for (size_t i = 0; i < depthFromLight; i++) contribution.subpathFromLight.push({});
+      size_t numBounces{depthFromCamera + depthFromLight - 2};
+      double sampleU{random.generate1()};
+      contribution.pathI = numBounces == 0 ? 1.0 : sampleU < 0.01 ? 100.0 : 1e-3;
+      contribution.pathL = mi::render::Spectrum{contribution.pathI};
+      contribution.pixelCoordinate = {numBounces + 0.5, 0.5};
+      return std::optional(std::move(contribution));
+    };
+    auto render = [&](size_t numReplicas) {
+      mi::render::PSMLTIntegrator integrator{{
+        .printProgress = false,
+        .seed = 3,
+        .maxBounces = 1,
+        .numBootstrapPaths = 10000,
+        .numMutations = 200000,
+        .numChains = 1000,
+        .numReplicas = numReplicas,
+        .minInverseTemperature = 0.1,
+        .numMutationsPerExchange = 4}};
+      mi::render::SpectrumImage image;
+      image.resize(1, {2, 1});
+      auto statistics{integrator(randomSampler, image)};
+      if (numReplicas > 1) CHECK(statistics.numAcceptedExchanges > 0);
+      return std::pair(image.extract({0, 0})[0], image.extract({1, 0})[0]);
+    };
+    auto [valueA0, valueA1] = render(1);
+    auto [valueB0, valueB1] = render(4);
+    // Every mutation records the overall value into the pixel of its number of bounces, so the pixels measure the
+    // time that the recording replicas spend at each number of bounces. This must be proportional to the integral
+    // for each number of bounces, which is 3 for no bounces and 4 for one bounce, after the depth combinations.
+    CHECK(valueB0 == Approx(valueA0).epsilon(0.1));
+    CHECK(valueB1 == Approx(valueA1).epsilon(0.1));
+    CHECK(std::abs(valueA1 / (valueA0 + valueA1) - 4.0 / 7.0) < 0.06);
+    CHECK(std::abs(valueB1 / (valueB0 + valueB1) - 4.0 / 7.0) < 0.06);
+  }
+}
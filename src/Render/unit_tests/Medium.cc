@@ -0,0 +1,145 @@
+#include "Microcosm/Render/Medium"
+#include "Microcosm/Render/More/Scattering/Media"
+#include "testing.h"
+
+TEST_CASE("Medium") {
+  SUBCASE("Variant dispatch matches type-erased dispatch") {
+    using Variant = mi::render::MediumVariant<mi::render::HomogeneousMedium>;
+    mi::render::Spectrum sigmaS{0.5, 0.7, 0.9};
+    mi::render::Spectrum sigmaA{0.1, 0.2, 0.3};
+    Variant variant{mi::render::HomogeneousMedium(sigmaS, sigmaA)};
+    mi::render::Medium medium{mi::render::HomogeneousMedium(sigmaS, sigmaA)};
+    mi::render::Random randomA{PRNG()};
+    mi::render::Random randomB{PRNG()};
+    for (int k = 0; k < 50; k++) {
+      mi::Ray3d ray{mi::Vector3d(0, 0, 0), mi::Vector3d(0, 0, 1), 0.0, 2.0};
+      mi::render::Spectrum trA{1.0, 1.0, 1.0};
+      mi::render::Spectrum trB{1.0, 1.0, 1.0};
+      variant.transmission(randomA, ray, trA);
+      medium.transmission(randomB, ray, trB);
+      CHECK(mi::allTrue(trA == trB));
+      mi::render::Spectrum ratioA{1.0, 1.0, 1.0};
+      mi::render::Spectrum ratioB{1.0, 1.0, 1.0};
+      auto scatteringA{variant.transmissionSample(randomA, ray, ratioA)};
+      auto scatteringB{medium.transmissionSample(randomB, ray, ratioB)};
+      CHECK(scatteringA.has_value() == scatteringB.has_value());
+      if (scatteringA && scatteringB) CHECK(mi::allTrue(scatteringA->position == scatteringB->position));
+      CHECK(mi::allTrue(ratioA == ratioB));
+    }
+  }
+}
+
+TEST_CASE("MajorantGrid") {
+  auto prng = PRNG();
+  mi::BoundBox3d boundBox{mi::Vector3d(-1, 0, 2), mi::Vector3d(2, 1, 4)};
+  mi::Vector3i count{3, 4, 5};
+  // Give every cell a distinct majorant, so that the segments identify the cells.
+  std::vector<double> majorants(count.product());
+  for (size_t i = 0; i < majorants.size(); i++) majorants[i] = double(i);
+  mi::render::MajorantGrid grid{boundBox, count, majorants};
+  auto checkSegments = [&](mi::Vector3d origin, mi::Vector3d direction) {
+    mi::Ray3d ray{origin, normalize(direction)};
+    auto params{boundBox.rayCast(ray)};
+    if (!params) return;
+    ray.minParam = std::max(params->first, 0.0);
+    ray.maxParam = std::min(params->second, ray.maxParam);
+    if (!(ray.minParam < ray.maxParam)) return;
+    double paramPrev{ray.minParam};
+    INFO("origin = ", origin, ", direction = ", direction);
+    grid.traverse(ray, [&](double minParam, double maxParam, double majorant) {
+      CHECK(minParam == paramPrev);
+      CHECK(minParam <= maxParam);
+      paramPrev = maxParam;
+      if (maxParam - minParam > 1e-9) {
+        mi::Vector3d position{(ray((minParam + maxParam) / 2) - boundBox.lower()) / boundBox.extent() * mi::Vector3d(count)};
+        mi::Vector3i cell;
+        for (size_t k = 0; k < 3; k++) cell[k] = std::clamp(int(std::floor(position[k])), 0, count[k] - 1);
+        CHECK_MESSAGE(majorant == grid.majorant(cell), "cell = ", cell);
+      }
+      return true;
+    });
+    CHECK(paramPrev == Approx(ray.maxParam));
+  };
+  SUBCASE("Segments tile the ray for axis-aligned directions") {
+    for (int i = 0; i < 100; i++) {
+      mi::Vector3d origin{boundBox.lower() + mi::randomize<mi::Vector3d>(prng) * boundBox.extent()};
+      for (size_t k = 0; k < 3; k++) {
+        mi::Vector3d direction{};
+        direction[k] = i % 2 == 0 ? +1 : -1;
+        checkSegments(origin, direction);
+      }
+    }
+  }
+  SUBCASE("Segments tile the ray for arbitrary directions") {
+    for (int i = 0; i < 500; i++) {
+      mi::Vector3d origin{boundBox.center() + (mi::randomize<mi::Vector3d>(prng) * 2.0 - 1.0) * boundBox.extent()};
+      mi::Vector3d direction{mi::randomize<mi::Vector3d>(prng) * 2.0 - 1.0};
+      if (i % 2 == 0) direction = -mi::abs(direction); // Make sure every component is negative half of the time.
+      checkSegments(origin, direction);
+    }
+  }
+}
+
+TEST_CASE("VoxelGridMedium") {
+  auto prng = PRNG();
+  mi::BoundBox3d boundBox{mi::Vector3d(-1, -2, 0), mi::Vector3d(1, 2, 3)};
+  mi::Vector3i count{11, 19, 13}; // Deliberately not multiples of the brick size.
+  std::vector<float> densities(count.product());
+  for (int z = 0, i = 0; z < count[2]; z++)
+    for (int y = 0; y < count[1]; y++)
+      for (int x = 0; x < count[0]; x++, i++) densities[i] = y < 10 ? 0.0f : mi::randomize<float>(prng) * 5.0f; // Leave empty bricks.
+  mi::render::Spectrum sigmaS{0.5, 0.7, 0.9};
+  mi::render::Spectrum sigmaA{0.1, 0.2, 0.3};
+  auto makeMedium = [&](bool sparse, bool halfPrecision) {
+    return mi::render::VoxelGridMedium(boundBox, count, densities, sigmaS, sigmaA, {}, {.sparse = sparse, .halfPrecision = halfPrecision});
+  };
+  auto randomPoint = [&] { return boundBox.lower() + mi::randomize<mi::Vector3d>(prng) * boundBox.extent(); };
+  auto mediumDense{makeMedium(false, false)};
+  auto mediumSparse{makeMedium(true, false)};
+  auto mediumHalf{makeMedium(true, true)};
+  SUBCASE("Density at voxel centers equals the voxel value") {
+    mi::Vector3d voxelSize{boundBox.extent() / mi::Vector3d(count)};
+    for (int z = 0, i = 0; z < count[2]; z++)
+      for (int y = 0; y < count[1]; y++)
+        for (int x = 0; x < count[0]; x++, i++) {
+          mi::Vector3d center{boundBox.lower() + (mi::Vector3d(x, y, z) + 0.5) * voxelSize};
+          CHECK_MESSAGE(mediumSparse.density(center) == Approx(densities[i]).epsilon(1e-6), "x = ", x, ", y = ", y, ", z = ", z);
+        }
+  }
+  SUBCASE("Sparse and dense storage agree, and half precision is close") {
+    for (int i = 0; i < 2000; i++) {
+      mi::Vector3d point{randomPoint()};
+      INFO("point = ", point);
+      CHECK(mediumSparse.density(point) == mediumDense.density(point));
+      CHECK(mediumHalf.density(point) == Approx(mediumSparse.density(point)).epsilon(1e-3));
+    }
+  }
+  SUBCASE("Brick majorants bound the extinction everywhere") {
+    for (const auto *medium : {&mediumDense, &mediumSparse, &mediumHalf}) {
+      const auto &grid{medium->majorantGrid()};
+      std::vector<mi::Vector3d> points;
+      for (int i = 0; i < 5000; i++) points.push_back(randomPoint());
+      // Also check at the voxel centers, where the densities peak.
+      mi::Vector3d voxelSize{boundBox.extent() / mi::Vector3d(count)};
+      for (int z = 0; z < count[2]; z++)
+        for (int y = 0; y < count[1]; y++)
+          for (int x = 0; x < count[0]; x++) points.push_back(boundBox.lower() + (mi::Vector3d(x, y, z) + 0.5) * voxelSize);
+      for (const mi::Vector3d &point : points) {
+        mi::Vector3d position{(point - grid.boundBox().lower()) / grid.boundBox().extent() * mi::Vector3d(grid.count())};
+        mi::Vector3i cell;
+        for (size_t k = 0; k < 3; k++) cell[k] = std::clamp(int(std::floor(position[k])), 0, grid.count()[k] - 1);
+        CHECK_MESSAGE(grid.majorant(cell) >= medium->density(point) * 1.2, "point = ", point);
+      }
+    }
+  }
+  SUBCASE("Stochastic lookup matches trilinear lookup on average") {
+    mi::render::Random random{PRNG()};
+    for (int i = 0; i < 10; i++) {
+      mi::Vector3d point{randomPoint()};
+      double mean{0};
+      for (int j = 0; j < 20000; j++) mean += mediumSparse.density(point, random);
+      mean /= 20000;
+      CHECK(mean == Approx(mediumSparse.density(point)).epsilon(0.05));
+    }
+  }
+}
@@ -0,0 +1,237 @@
+#include "Microcosm/Render/Path"
+#include "testing.h"
+
+namespace {
+
+/// A scattering function whose density depends only on the sampled direction, so that the runtimes of a vertex are
+/// the same no matter which other vertices it is connected or merged with.
+struct LopsidedBSDF {
+  using bsdf_tag = std::true_type;
+  mi::Vector3d axis{};
+  [[nodiscard]] double density(mi::Vector3d omega) const noexcept { return mi::render::OneOverFourPi * (1 + 0.5 * mi::dot(omega, axis)); }
+  mi::render::BidirPDF scatter(mi::Vector3d omegaO, mi::Vector3d omegaI, mi::render::Spectrum &f) const {
+    f += 0.8 * density(omegaI);
+    return {density(omegaI), density(omegaO)};
+  }
+  mi::render::BidirPDF scatterSample(mi::render::Random &, mi::Vector3d, mi::Vector3d &, mi::render::Spectrum &) const { return {}; }
+};
+
+} // namespace
+
+TEST_CASE("PathConnector") {
+  auto prng = PRNG();
+  // Random volume vertices, with random scattering PDFs and flags. None of these need materials, since the weights
+  // only look at the runtimes.
+  auto randomPath = [&](mi::render::Path::Kind kind, size_t size) {
+    mi::render::Path path;
+    for (size_t k = 0; k < size; k++) {
+      mi::render::Path::Vertex vertex;
+      vertex.position = mi::randomize<mi::Vector3d>(prng) * 4.0 - 2.0;
+      vertex.runtime.kind = kind;
+      vertex.runtime.scatteringPDF.forward = 0.1 + mi::randomize<double>(prng);
+      vertex.runtime.scatteringPDF.reverse = 0.1 + mi::randomize<double>(prng);
+      vertex.runtime.flags.isDeltaScattering = k > 0 && mi::randomize<double>(prng) < 0.25;
+      vertex.runtime.flags.isIncomplete = k > 0 && mi::randomize<double>(prng) < 0.25;
+      path.push(vertex);
+    }
+    for (size_t k = 0; k < size; k++) {
+      if (k > 0) path[k].recalculateForwardPathPDF(path[k - 1]);
+      if (k + 1 < size) path[k].recalculateReversePathPDF(path[k + 1]);
+    }
+    path[0].runtime.pathPDF.forward = 1;
+    return path;
+  };
+  SUBCASE("Incremental weights match the full-path loop") {
+    // The weights as calculated before the partial sums, by looping over every vertex of both subpaths.
+    auto fullPathWeight = [](mi::render::PathView pathA, mi::render::PathView pathB) {
+      ptrdiff_t nA{pathA.size()};
+      ptrdiff_t nB{pathB.size()};
+      if (nA > 0 && nB > 0) {
+        pathA[nA - 1].recalculateReversePathPDF(pathB[nB - 1]);
+        pathB[nB - 1].recalculateReversePathPDF(pathA[nA - 1]);
+      }
+      if (nA > 1) pathA[nA - 2].recalculateReversePathPDF(pathA[nA - 1]);
+      if (nB > 1) pathB[nB - 2].recalculateReversePathPDF(pathB[nB - 1]);
+      auto denom = [](mi::render::PathView path) {
+        double result{1};
+        for (auto &vertex : path) {
+          if (!vertex.runtime.flags.isDeltaScattering) {
+            result *= vertex.runtime.pathPDF.reverse / vertex.runtime.pathPDF.forward;
+            result += vertex.runtime.flags.isIncomplete ? 0 : 1;
+          }
+        }
+        return result;
+      };
+      return mi::finiteOrZero(1 / (denom(pathA) + denom(pathB) - 1));
+    };
+    mi::render::PathConnector connector;
+    for (int trial = 0; trial < 50; trial++) {
+      mi::render::Path pathA{randomPath(mi::render::Path::Kind::Camera, 1 + prng() % 7)};
+      mi::render::Path pathB{randomPath(mi::render::Path::Kind::Light, 1 + prng() % 7)};
+      for (ptrdiff_t i = 0; i <= ptrdiff_t(pathA.size()); i++) {
+        for (ptrdiff_t j = 0; j <= ptrdiff_t(pathB.size()); j++) {
+          // Note: Both calculations change the reverse path PDFs, so work on fresh copies every time. The public weight
+          // must not depend on the partial weights being up to date, so poison them first.
+          mi::render::Path pathA0{pathA}, pathA1{pathA};
+          mi::render::Path pathB0{pathB}, pathB1{pathB};
+          for (auto &vertex : pathA0) vertex.runtime.partialWeight = mi::constants::NaN<double>;
+          for (auto &vertex : pathB0) vertex.runtime.partialWeight = mi::constants::NaN<double>;
+          double weight0{connector.multipleImportanceWeight(mi::render::PathView(&pathA0[0], size_t(i)), mi::render::PathView(&pathB0[0], size_t(j)))};
+          double weight1{fullPathWeight(mi::render::PathView(&pathA1[0], size_t(i)), mi::render::PathView(&pathB1[0], size_t(j)))};
+          CHECK_MESSAGE(weight0 == Approx(weight1).epsilon(1e-12), "trial = ", trial, ", i = ", i, ", j = ", j);
+        }
+      }
+    }
+  }
+  SUBCASE("Batched connections match connecting every pair of subpaths") {
+    // Every stub is a deterministic function of the vertices it sees, so that the two ways of connecting agree
+    // exactly, no matter in which order the visibility is resolved.
+    auto randomScatteringPath = [&](mi::render::Path::Kind kind, size_t size) {
+      mi::render::Path path{randomPath(kind, size)};
+      for (auto &vertex : path) {
+        vertex.runtime.ratio = mi::render::spectrumLinspace(4, 0.5 + mi::randomize<double>(prng), 0.5 + mi::randomize<double>(prng));
+        vertex.runtime.omegaO = mi::render::uniformSphereSample(mi::randomize<mi::Vector2d>(prng));
+        vertex.material.scattering = mi::render::Scattering(LopsidedBSDF{mi::render::uniformSphereSample(mi::randomize<mi::Vector2d>(prng))});
+      }
+      return path;
+    };
+    auto truncater = [](mi::render::Path::Vertex &vertex) {
+      if (!(vertex.position[0] > -1)) return false;
+      vertex.runtime.ratio *= 0.5 + std::abs(vertex.position[1]);
+      vertex.runtime.pathPDF.reverse = 0.5 + std::abs(vertex.position[2]);
+      vertex.runtime.scatteringPDF.reverse = 0.3;
+      return true;
+    };
+    auto completer = [](const mi::render::Path::Vertex &vertexP, mi::render::Path::Vertex &vertexQ) {
+      if (!(vertexP.position[1] > -1.5)) return false;
+      vertexQ.position = vertexP.position + mi::Vector3d(0.3, -0.2, 1.0);
+      vertexQ.runtime.kind = vertexP.runtime.kind == mi::render::Path::Kind::Camera ? mi::render::Path::Kind::Light : mi::render::Path::Kind::Camera;
+      vertexQ.runtime.omegaI = vertexQ.omega(vertexP);
+      vertexQ.runtime.pathPDF.forward = 0.7;
+      vertexQ.runtime.scatteringPDF.forward = 0.4;
+      vertexQ.runtime.ratio = mi::render::spectrumLinspace(4, 1.0, 2.0);
+      return true;
+    };
+    auto visibilityTester = [](const mi::render::Path::Vertex &vertexP, const mi::render::Path::Vertex &vertexQ, mi::render::Spectrum &L) {
+      if (!(std::sin(7 * mi::dot(vertexP.position, mi::Vector3d(1, 2, 3)) + 5 * mi::dot(vertexQ.position, mi::Vector3d(3, 1, 2))) > -0.3)) return false;
+      L *= 0.5 + 0.25 * std::cos(mi::distance(vertexP.position, vertexQ.position));
+      return true;
+    };
+    auto shuffledBatchVisibilityTester = [&](std::span<mi::render::PathConnector::VisibilityQuery> queries) {
+      std::vector<size_t> order(queries.size());
+      std::iota(order.begin(), order.end(), size_t(0));
+      std::shuffle(order.begin(), order.end(), prng);
+      for (size_t k : order) queries[k].isVisible = visibilityTester(*queries[k].vertexP, *queries[k].vertexQ, *queries[k].L);
+    };
+    struct Connection {
+      size_t sizeA{};
+      size_t sizeB{};
+      double weight{};
+      mi::render::Spectrum L{};
+    };
+    mi::render::Random random{prng};
+    size_t numConnections{0};
+    for (bool batched : {false, true}) {
+      mi::render::PathConnector connector{truncater, completer, visibilityTester};
+      if (batched) connector = mi::render::PathConnector{truncater, completer, visibilityTester, shuffledBatchVisibilityTester};
+      for (int trial = 0; trial < 50; trial++) {
+        mi::render::Path pathA{randomScatteringPath(mi::render::Path::Kind::Camera, 1 + prng() % 6)};
+        mi::render::Path pathB{randomScatteringPath(mi::render::Path::Kind::Light, 1 + prng() % 6)};
+        std::vector<Connection> connections0;
+        std::vector<Connection> connections1;
+        connector.connect(random, mi::render::PathView(pathA.begin(), pathA.end()), mi::render::PathView(pathB.begin(), pathB.end()), [&](auto subpathA, auto subpathB, double weight, const auto &L) { connections0.push_back({size_t(subpathA.size()), size_t(subpathB.size()), weight, L}); });
+        for (ptrdiff_t i = 0; i <= ptrdiff_t(pathA.size()); i++) {
+          for (ptrdiff_t j = 0; j <= ptrdiff_t(pathB.size()); j++) {
+            connector.connectTerm(random, mi::render::PathView(&pathA[0], size_t(i)), mi::render::PathView(&pathB[0], size_t(j)), [&](auto subpathA, auto subpathB, double weight, const auto &L) { connections1.push_back({size_t(subpathA.size()), size_t(subpathB.size()), weight, L}); });
+          }
+        }
+        INFO("batched = ", batched, ", trial = ", trial);
+        REQUIRE(connections0.size() == connections1.size());
+        for (size_t k = 0; k < connections0.size(); k++) {
+          INFO("k = ", k);
+          CHECK(connections0[k].sizeA == connections1[k].sizeA);
+          CHECK(connections0[k].sizeB == connections1[k].sizeB);
+          CHECK(connections0[k].weight == Approx(connections1[k].weight).epsilon(1e-12));
+          CHECK(mi::allTrue(mi::abs(connections0[k].L - connections1[k].L) <= 1e-12 * mi::abs(connections1[k].L)));
+        }
+        numConnections += connections0.size();
+      }
+    }
+    CHECK(numConnections > 200);
+  }
+  SUBCASE("Connection and merge weights sum to one") {
+    // Form one full path with opaque surface vertices between the camera and the light. Every way of sampling it, by
+    // connecting at any edge or by merging at any interior vertex, must have weights that sum to one.
+    mi::render::Random random{prng};
+    for (int trial = 0; trial < 50; trial++) {
+      ptrdiff_t n{ptrdiff_t(3 + prng() % 5)};
+      std::vector<mi::render::Path::Vertex> vertices(n);
+      std::vector<LopsidedBSDF> bsdfs(n);
+      for (ptrdiff_t k = 0; k < n; k++) {
+        vertices[k].position = mi::randomize<mi::Vector3d>(prng) * 4.0 - 2.0;
+        vertices[k].runtime.ratio = mi::render::spectrumLinspace(4, 1.0, 1.0);
+        bsdfs[k].axis = mi::render::uniformSphereSample(mi::randomize<mi::Vector2d>(prng));
+        if (0 < k && k < n - 1) {
+          mi::render::Manifold manifold;
+          manifold.point = vertices[k].position;
+          manifold.correct.normal = manifold.shading.normal = mi::render::uniformSphereSample(mi::randomize<mi::Vector2d>(prng));
+          vertices[k].manifold = manifold;
+          vertices[k].material.scattering = mi::render::Scattering(bsdfs[k]);
+          vertices[k].flagKnownOpaque();
+        }
+      }
+      // The sources have arbitrary position and direction densities, for either kind of path.
+      double cameraPositionPDF{0.5 + mi::randomize<double>(prng)};
+      double cameraDirectionPDF{0.5 + mi::randomize<double>(prng)};
+      double lightPositionPDF{0.5 + mi::randomize<double>(prng)};
+      double lightDirectionPDF{0.5 + mi::randomize<double>(prng)};
+      auto fullPath = [&](mi::render::Path::Kind kind) {
+        bool fromCamera{kind == mi::render::Path::Kind::Camera};
+        mi::render::Path path;
+        for (ptrdiff_t k = 0; k < n; k++) {
+          ptrdiff_t i{fromCamera ? k : n - 1 - k};
+          ptrdiff_t prev{fromCamera ? i - 1 : i + 1};
+          ptrdiff_t next{fromCamera ? i + 1 : i - 1};
+          mi::render::Path::Vertex vertex{vertices[i]};
+          vertex.runtime.kind = kind;
+          if (k > 0) vertex.runtime.omegaO = vertex.omega(vertices[prev]);
+          if (k > 0) vertex.runtime.scatteringPDF.reverse = bsdfs[i].density(vertex.runtime.omegaO);
+          if (k < n - 1) vertex.runtime.scatteringPDF.forward = bsdfs[i].density(vertex.omega(vertices[next]));
+          path.push(vertex);
+        }
+        path[0].runtime.scatteringPDF.forward = fromCamera ? cameraDirectionPDF : lightDirectionPDF;
+        path[0].runtime.pathPDF.forward = fromCamera ? cameraPositionPDF : lightPositionPDF;
+        path[n - 1].runtime.scatteringPDF.reverse = fromCamera ? lightDirectionPDF : cameraDirectionPDF;
+        path[n - 1].runtime.pathPDF.reverse = fromCamera ? lightPositionPDF : cameraPositionPDF;
+        for (ptrdiff_t k = 0; k < n; k++) {
+          if (k > 0) path[k].recalculateForwardPathPDF(path[k - 1]);
+          if (k + 1 < n) path[k].recalculateReversePathPDF(path[k + 1]);
+        }
+        return path;
+      };
+      mi::render::Path pathA{fullPath(mi::render::Path::Kind::Camera)};
+      mi::render::Path pathB{fullPath(mi::render::Path::Kind::Light)};
+      for (double mergeFactor : {0.0, 0.02 + mi::randomize<double>(prng)}) {
+        mi::render::PathConnector connector;
+        connector.setMergeFactor(mergeFactor);
+        double weightSum{0};
+        for (ptrdiff_t i = 0; i <= n; i++) {
+          mi::render::Path pathA0{pathA};
+          mi::render::Path pathB0{pathB};
+          connector.accumulatePartialWeights(mi::render::PathView(pathA0.begin(), pathA0.end()));
+          connector.accumulatePartialWeights(mi::render::PathView(pathB0.begin(), pathB0.end()));
+          weightSum += connector.multipleImportanceWeight(mi::render::PathView(&pathA0[0], size_t(i)), mi::render::PathView(&pathB0[0], size_t(n - i)));
+          if (mergeFactor > 0 && 0 < i && i < n - 1) {
+            int numMerges{0};
+            connector.merge(random, mi::render::PathView(&pathA0[0], size_t(i + 1)), mi::render::ConstPathView(&pathB0[0], size_t(n - i)), [&](auto, auto, double weight, auto &) {
+              weightSum += weight;
+              numMerges++;
+            });
+            CHECK_MESSAGE(numMerges == 1, "trial = ", trial, ", i = ", i);
+          }
+        }
+        CHECK_MESSAGE(weightSum == Approx(1.0).epsilon(1e-9), "trial = ", trial, ", mergeFactor = ", mergeFactor);
+      }
+    }
+  }
+}
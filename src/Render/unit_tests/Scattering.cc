@@ -0,0 +1,40 @@
+#include "Microcosm/Render/More/Scattering/Diffuse"
+#include "Microcosm/Render/Scattering"
+#include "testing.h"
+
+TEST_CASE("Scattering") {
+  SUBCASE("Variant dispatch matches type-erased dispatch") {
+    using Variant = mi::render::ScatteringVariant<mi::render::LambertBSDF, mi::render::OrenNayarBRDF>;
+    mi::render::Spectrum valueR{0.2, 0.5, 0.8};
+    mi::render::Spectrum valueT{0.1, 0.1, 0.1};
+    mi::render::Spectrum sigma{0.3, 0.3, 0.3};
+    std::vector<Variant> variants{mi::render::LambertBSDF(valueR, valueT), mi::render::OrenNayarBRDF(valueR, sigma)};
+    std::vector<mi::render::Scattering> scatterings{mi::render::LambertBSDF(valueR, valueT), mi::render::OrenNayarBRDF(valueR, sigma)};
+    for (size_t i = 0; i < variants.size(); i++) {
+      mi::render::Random randomA{PRNG()};
+      mi::render::Random randomB{PRNG()};
+      for (int k = 0; k < 50; k++) {
+        mi::Vector3d omegaO{normalize(mi::Vector3d(0.3, -0.2, 0.9))};
+        mi::Vector3d omegaIA;
+        mi::Vector3d omegaIB;
+        mi::render::Spectrum ratioA{1.0, 1.0, 1.0};
+        mi::render::Spectrum ratioB{1.0, 1.0, 1.0};
+        bool isDeltaA{false};
+        bool isDeltaB{false};
+        auto densityA{variants[i].scatterSample(randomA, omegaO, omegaIA, ratioA, isDeltaA)};
+        auto densityB{scatterings[i].scatterSample(randomB, omegaO, omegaIB, ratioB, isDeltaB)};
+        CHECK(densityA.forward == densityB.forward);
+        CHECK(densityA.reverse == densityB.reverse);
+        CHECK(mi::allTrue(omegaIA == omegaIB));
+        CHECK(mi::allTrue(ratioA == ratioB));
+        CHECK(isDeltaA == isDeltaB);
+        mi::render::Spectrum fA{0.0, 0.0, 0.0};
+        mi::render::Spectrum fB{0.0, 0.0, 0.0};
+        densityA = variants[i].scatter(randomA, omegaO, omegaIA, fA);
+        densityB = scatterings[i].scatter(randomB, omegaO, omegaIB, fB);
+        CHECK(densityA.forward == densityB.forward);
+        CHECK(mi::allTrue(fA == fB));
+      }
+    }
+  }
+}
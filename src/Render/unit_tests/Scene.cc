@@ -0,0 +1,76 @@
+#include "Microcosm/Render/Scene"
+#include "testing.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<size_t> numAllocations{0};
+
+void *operator new(size_t size) {
+  numAllocations++;
+  if (void *ptr = std::malloc(size == 0 ? 1 : size)) return ptr;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+
+void operator delete(void *ptr, size_t) noexcept { std::free(ptr); }
+
+namespace {
+
+/// An isotropic scattering function, small enough to be stored inline by std::any.
+struct IsotropicBSDF {
+  using bsdf_tag = std::true_type;
+  double albedo{0.8};
+  mi::render::BidirPDF scatter(mi::Vector3d, mi::Vector3d, mi::render::Spectrum &f) const {
+    f += albedo * mi::render::OneOverFourPi;
+    return {mi::render::OneOverFourPi, mi::render::OneOverFourPi};
+  }
+  mi::render::BidirPDF scatterSample(mi::render::Random &random, mi::Vector3d, mi::Vector3d &omegaI, mi::render::Spectrum &ratio) const {
+    omegaI = mi::render::uniformSphereSample(random.generate2());
+    ratio *= albedo;
+    return {mi::render::OneOverFourPi, mi::render::OneOverFourPi};
+  }
+};
+
+} // namespace
+
+TEST_CASE("Scene") {
+  SUBCASE("Reused path does not allocate") {
+    // Two parallel planes at Z = 0 and Z = 2, so the walk bounces between them until it escapes.
+    mi::render::MaterialProvider provider{[](const mi::render::Spectrum &) { return mi::render::Material{.scattering = IsotropicBSDF{}}; }};
+    mi::render::Scene scene{[&](mi::Ray3d ray, mi::render::Path::Vertex &vertex) -> std::optional<double> {
+      std::optional<double> result;
+      for (double planeZ : {0.0, 2.0}) {
+        double param{(planeZ - ray.origin[2]) / ray.direction[2]};
+        if (ray.minParam < param && param < ray.maxParam && (!result || param < *result)) result = param;
+      }
+      if (result) {
+        mi::render::Manifold manifold;
+        manifold.point = ray(*result);
+        manifold.correct.normal = manifold.shading.normal = mi::Vector3d(0, 0, 1);
+        vertex.position = manifold.point;
+        vertex.manifold = manifold;
+        vertex.materialProvider = provider;
+      }
+      return result;
+    }};
+    mi::render::Spectrum waveLens{0.4, 0.5, 0.6, 0.7};
+    mi::render::Random random{mi::Pcg32()};
+    mi::render::Path::Vertex firstVertex{mi::Vector3d(0, 0, 1)};
+    firstVertex.fromCamera().withRatio(mi::render::Spectrum{1.0, 1.0, 1.0, 1.0}).withOmegaI(mi::Vector3d(0.6, 0, 0.8)).withForwardPathPDF(1).withForwardScatteringPDF(1);
+    mi::render::Path path;
+    size_t maxSize{0};
+    auto walkMany = [&](int count) {
+      for (int k = 0; k < count; k++) {
+        scene.walk(waveLens, random, firstVertex, path, /*maxDepth=*/16);
+        maxSize = std::max(maxSize, path.size());
+      }
+    };
+    walkMany(1000); // Warm up, so that the path has grown to its steady state.
+    size_t numAllocationsBefore{numAllocations};
+    walkMany(1000);
+    CHECK(numAllocations == numAllocationsBefore);
+    CHECK(maxSize > 4);
+  }
+}
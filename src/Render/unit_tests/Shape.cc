@@ -0,0 +1,155 @@
+#include "Microcosm/Render/More/Shape/Disk"
+#include "Microcosm/Render/More/Shape/Sphere"
+#include "Microcosm/Render/Shape"
+#include "testing.h"
+
+TEST_CASE("Shape") {
+  auto prng = PRNG();
+  using Variant = mi::render::ShapeVariant<mi::render::Sphere, mi::render::Disk>;
+  std::vector<Variant> variants{mi::render::Sphere(1.0), mi::render::Disk(2.0, 0.5), mi::render::Sphere(0.5), mi::render::Disk(1.5, -0.3)};
+  std::vector<mi::render::Shape> shapes{mi::render::Sphere(1.0), mi::render::Disk(2.0, 0.5), mi::render::Sphere(0.5), mi::render::Disk(1.5, -0.3)};
+  auto randomRay = [&] {
+    mi::Vector3d origin{mi::randomize<mi::Vector3d>(prng) * 6.0 - 3.0};
+    mi::Vector3d target{mi::randomize<mi::Vector3d>(prng) * 2.0 - 1.0};
+    return mi::Ray3d(origin, normalize(target - origin));
+  };
+  SUBCASE("Variant dispatch matches type-erased dispatch") {
+    for (size_t i = 0; i < variants.size(); i++) {
+      CHECK(mi::allTrue(variants[i].box()[0] == shapes[i].box()[0]));
+      CHECK(mi::allTrue(variants[i].box()[1] == shapes[i].box()[1]));
+      for (int k = 0; k < 50; k++) {
+        mi::Ray3d ray{randomRay()};
+        mi::render::Manifold manifoldA;
+        mi::render::Manifold manifoldB;
+        auto paramA{variants[i].intersect(ray, manifoldA)};
+        auto paramB{shapes[i].intersect(ray, manifoldB)};
+        CHECK(paramA == paramB);
+        if (paramA && paramB) CHECK(mi::allTrue(manifoldA.point == manifoldB.point));
+      }
+    }
+  }
+  SUBCASE("Group of variants matches group of type-erased shapes") {
+    mi::render::BasicShapeGroup<Variant> groupA{variants, {.leafLimit = 1}};
+    mi::render::ShapeGroup groupB{shapes, {.leafLimit = 1}};
+    for (int k = 0; k < 200; k++) {
+      mi::Ray3d ray{randomRay()};
+      mi::render::Manifold manifoldA;
+      mi::render::Manifold manifoldB;
+      auto paramA{groupA.intersect(ray, manifoldA)};
+      auto paramB{groupB.intersect(ray, manifoldB)};
+      CHECK(paramA == paramB);
+    }
+  }
+  SUBCASE("Group matches linear scan") {
+    std::vector<mi::render::Shape> children;
+    for (int i = 0; i < 60; i++) {
+      mi::render::Shape child{mi::render::Sphere(0.1 + 0.3 * mi::randomize<double>(prng))};
+      child.onTransform(mi::render::AffineTransform(mi::Matrix3d::identity(), mi::randomize<mi::Vector3d>(prng) * 4.0 - 2.0));
+      children.push_back(std::move(child));
+    }
+    mi::render::ShapeGroup group{children};
+    for (int k = 0; k < 200; k++) {
+      mi::Ray3d ray{randomRay()};
+      mi::render::Manifold manifoldA;
+      mi::render::Manifold manifoldB;
+      std::optional<double> paramA{group.intersect(ray, manifoldA)};
+      std::optional<double> paramB{};
+      for (const auto &child : children) {
+        if (auto param = child.intersect(ray, manifoldB)) ray.maxParam = *param, paramB = param;
+      }
+      CHECK(paramA.has_value() == paramB.has_value());
+      if (paramA && paramB) {
+        CHECK(*paramA == Approx(*paramB));
+        CHECK(mi::allTrue(mi::abs(manifoldA.point - manifoldB.point) < 1e-6));
+      }
+    }
+    for (int k = 0; k < 200; k++) {
+      mi::Vector3d referencePoint{mi::randomize<mi::Vector3d>(prng) * 6.0 - 3.0};
+      mi::render::Manifold manifoldA;
+      mi::render::Manifold manifoldB;
+      std::optional<double> distA{group.nearestTo(referencePoint, manifoldA)};
+      std::optional<double> distB{};
+      for (const auto &child : children) {
+        if (auto dist = child.nearestTo(referencePoint, manifoldB)) distB = dist;
+      }
+      CHECK(distA.has_value());
+      CHECK(distB.has_value());
+      if (distA && distB) {
+        CHECK(*distA == Approx(*distB));
+        CHECK(mi::allTrue(mi::abs(manifoldA.point - manifoldB.point) < 1e-6));
+      }
+    }
+  }
+  SUBCASE("Instances match transformed copies") {
+    std::vector<std::shared_ptr<const mi::render::Shape>> prototypes{
+      std::make_shared<const mi::render::Shape>(mi::render::Sphere(0.5)), //
+      std::make_shared<const mi::render::Shape>(mi::render::Disk(0.8, 0.2))};
+    auto randomInstances = [&](bool uniformScale) {
+      std::vector<mi::render::ShapeInstances::Instance> instances;
+      for (int i = 0; i < 40; i++) {
+        mi::Matrix3d matrix{mi::Quaterniond::rotate(6.0 * mi::randomize<double>(prng), mi::randomize<mi::Vector3d>(prng) - 0.5)};
+        mi::Matrix3d scale{mi::Matrix3d::identity() * (0.5 + mi::randomize<double>(prng))};
+        if (!uniformScale) scale(1, 1) *= 0.3, scale(2, 2) *= 2.0;
+        instances.push_back({uint32_t(i % 2), mi::render::AffineTransform(mi::dot(matrix, scale), mi::randomize<mi::Vector3d>(prng) * 4.0 - 2.0)});
+      }
+      return instances;
+    };
+    auto transformedCopies = [&](const std::vector<mi::render::ShapeInstances::Instance> &instances) {
+      std::vector<mi::render::Shape> copies;
+      for (const auto &instance : instances) {
+        mi::render::Shape copy{*prototypes[instance.prototype]};
+        copy.onTransform(instance.transform);
+        copies.push_back(std::move(copy));
+      }
+      return copies;
+    };
+    for (bool uniformScale : {true, false}) {
+      mi::render::ShapeInstances shapeInstances{prototypes, randomInstances(uniformScale)};
+      std::vector<mi::render::Shape> copies{transformedCopies(shapeInstances.instances())};
+      for (int k = 0; k < 200; k++) {
+        mi::Ray3d ray{randomRay()};
+        mi::render::Manifold manifoldA;
+        mi::render::Manifold manifoldB;
+        std::optional<double> paramA{shapeInstances.intersect(ray, manifoldA)};
+        std::optional<double> paramB{};
+        uint32_t instanceIndex{};
+        for (uint32_t i = 0; i < copies.size(); i++) {
+          if (auto param = copies[i].intersect(ray, manifoldB)) ray.maxParam = *param, paramB = param, instanceIndex = i;
+        }
+        CHECK(paramA.has_value() == paramB.has_value());
+        if (paramA && paramB) {
+          CHECK(*paramA == Approx(*paramB));
+          CHECK(manifoldA.instanceIndex == instanceIndex);
+          CHECK(mi::allTrue(mi::abs(manifoldA.point - manifoldB.point) < 1e-6));
+        }
+      }
+      for (int k = 0; k < 200; k++) {
+        mi::Vector3d referencePoint{mi::randomize<mi::Vector3d>(prng) * 6.0 - 3.0};
+        if (uniformScale) {
+          // Note: The transformed copies measure distances in their local space, so convert to world space here.
+          mi::render::Manifold manifoldA;
+          std::optional<double> distA{shapeInstances.nearestTo(referencePoint, manifoldA)};
+          double distB{mi::constants::Inf<double>};
+          for (const auto &copy : copies) {
+            mi::render::Manifold manifoldB;
+            if (copy.nearestTo(referencePoint, manifoldB)) distB = std::min(distB, mi::distance(referencePoint, manifoldB.point));
+          }
+          CHECK(distA.has_value());
+          if (distA) CHECK(*distA == Approx(distB));
+        } else {
+          // The query is only approximate, but it must report the true distance, and never exceed the bound.
+          mi::render::Manifold manifold;
+          manifold.nearestDistance = 0.5 + mi::randomize<double>(prng);
+          const double nearestDistance{manifold.nearestDistance};
+          if (auto dist = shapeInstances.nearestTo(referencePoint, manifold)) {
+            CHECK(*dist < nearestDistance);
+            CHECK(*dist == Approx(mi::distance(referencePoint, manifold.point)));
+          } else {
+            CHECK(manifold.nearestDistance == nearestDistance);
+          }
+        }
+      }
+    }
+  }
+}
+
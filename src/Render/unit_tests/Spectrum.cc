@@ -0,0 +1,44 @@
+#include "Microcosm/Render/Spectrum"
+#include "testing.h"
+
+TEST_CASE("Spectrum") {
+  auto prng = PRNG();
+  SUBCASE("Tabulated color matching functions match the Wyman fits") {
+    // The fits are only accurate to about 1e-3 of the peak, so this is a sanity check of the table lookup.
+    mi::render::Spectrum waveLens{mi::render::spectrumLinspace(200, 0.36, 0.83)};
+    mi::render::Spectrum valuesX;
+    mi::render::Spectrum valuesY;
+    mi::render::Spectrum valuesZ;
+    mi::render::colorMatchingXYZ(waveLens, valuesX, valuesY, valuesZ);
+    for (size_t i = 0; i < waveLens.size(); i++) {
+      mi::Vector3d expected{mi::wymanFit1931X(waveLens[i]), mi::wymanFit1931Y(waveLens[i]), mi::wymanFit1931Z(waveLens[i])};
+      mi::Vector3d actual{mi::render::colorMatchingXYZ(waveLens[i])};
+      INFO("waveLen = ", waveLens[i], ", expected = ", expected, ", actual = ", actual);
+      CHECK(mi::allTrue(mi::abs(actual - expected) < 2e-3));
+      CHECK(valuesX[i] == Approx(actual[0]).epsilon(1e-9));
+      CHECK(valuesY[i] == Approx(actual[1]).epsilon(1e-9));
+      CHECK(valuesZ[i] == Approx(actual[2]).epsilon(1e-9));
+    }
+    CHECK(mi::allTrue(mi::render::colorMatchingXYZ(0.30) == 0.0));
+    CHECK(mi::allTrue(mi::render::colorMatchingXYZ(0.90) == 0.0));
+  }
+  SUBCASE("RGB to spectrum to RGB round trip") {
+    // The table is fit to reproduce the color as an albedo under the D65 illuminant, which is the white point of sRGB.
+    mi::render::Spectrum waveLens{mi::render::spectrumLinspace(471, 0.36, 0.83)};
+    mi::render::Spectrum illuminant{mi::render::spectrumIlluminantD65(waveLens)};
+    double illuminantY{mi::render::convertSpectrumToXYZ(waveLens, illuminant)[1]};
+    if (!mi::render::RGBToSpectrumTable::hasStandard()) CHECK_THROWS_AS((void)mi::render::RGBToSpectrumTable::standard(), std::logic_error);
+    mi::render::RGBToSpectrumTable::initializeStandard();
+    CHECK(mi::render::RGBToSpectrumTable::hasStandard());
+    CHECK_THROWS_AS(mi::render::RGBToSpectrumTable::initializeStandard(mi::render::RGBToSpectrumTable(2)), std::logic_error);
+    const auto &table{mi::render::RGBToSpectrumTable::standard()};
+    CHECK(table.resolution() == mi::render::RGBToSpectrumTable::DefaultResolution);
+    for (int i = 0; i < 100; i++) {
+      mi::Vector3d color{mi::randomize<mi::Vector3d>(prng) * 0.8 + 0.1};
+      mi::render::Spectrum values{table.albedo(waveLens, color)};
+      CHECK(mi::allTrue(values >= 0.0 && values <= 1.0));
+      mi::Vector3d colorAgain{mi::render::convertSpectrumToRGB(waveLens, values * illuminant) / illuminantY};
+      CHECK(mi::allTrue(mi::abs(colorAgain - color) < 0.02));
+    }
+  }
+}
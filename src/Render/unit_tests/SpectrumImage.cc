@@ -0,0 +1,144 @@
+#include "Microcosm/Render/SpectrumImage"
+#include "Microcosm/miniz"
+#include "testing.h"
+#include <cstring>
+#include <set>
+#include <sstream>
+
+TEST_CASE("SpectrumImage") {
+  auto prng = PRNG();
+  SUBCASE("Pixel offsets are a bijection") {
+    // Deliberately use sizes that are not multiples of the tile size, so that the tiles are partial.
+    for (mi::Vector2i size : {mi::Vector2i(1, 1), mi::Vector2i(13, 21), mi::Vector2i(8, 17), mi::Vector2i(30, 7)}) {
+      for (bool tiled : {false, true}) {
+        mi::render::SpectrumImage image;
+        image.resize(1, size, tiled);
+        std::set<size_t> offsets;
+        for (int y = 0; y < size[1]; y++) {
+          for (int x = 0; x < size[0]; x++) {
+            size_t offset{image.pixelOffset({x, y})};
+            CHECK_MESSAGE(offset < size_t(image.numPixelsInStorage()), "x = ", x, ", y = ", y, ", tiled = ", tiled);
+            offsets.insert(offset);
+          }
+        }
+        CHECK(offsets.size() == size_t(size[0]) * size_t(size[1]));
+      }
+    }
+  }
+  SUBCASE("Accumulator is equivalent to adding directly") {
+    for (size_t maxTiles : {1, 3, 256}) {
+      mi::render::SpectrumImage imageA;
+      mi::render::SpectrumImage imageB;
+      imageA.resize(2, {27, 19}, /*tiled=*/true);
+      imageB.resize(2, {27, 19});
+      {
+        mi::render::SpectrumImageAccumulator accumulator{imageA, maxTiles};
+        for (int i = 0; i < 2000; i++) {
+          mi::Vector2i index{int(prng() % 27), int(prng() % 19)};
+          mi::render::Spectrum values{mi::randomize<double>(prng), mi::randomize<double>(prng) - 0.5};
+          double weight{i % 7 == 0 ? 0.0 : mi::randomize<double>(prng)};
+          accumulator.add(index, values, weight);
+          imageB.add(index, values, weight);
+        }
+      }
+      for (int y = 0; y < 19; y++) {
+        for (int x = 0; x < 27; x++) {
+          auto pixelA{imageA.pixelReference({x, y})};
+          auto pixelB{imageB.pixelReference({x, y})};
+          INFO("x = ", x, ", y = ", y);
+          CHECK(pixelA.num == pixelB.num);
+          CHECK(pixelA.weight.load() == Approx(pixelB.weight.load()).epsilon(1e-9));
+          for (int k = 0; k < 2; k++) CHECK(pixelA.values[k].load() == Approx(pixelB.values[k].load()).epsilon(1e-9));
+        }
+      }
+    }
+  }
+  SUBCASE("Write PFM and OpenEXR") {
+    mi::render::SpectrumImage image;
+    image.resize(3, {37, 21});
+    for (int y = 0; y < 21; y++)
+      for (int x = 0; x < 37; x++) image.add({x, y}, mi::render::Spectrum{x / 37.0, y / 21.0, 0.5}, 2.0);
+    mi::render::SpectrumImage::ExportOptions options{};
+    std::vector<float> color{image.convertToColor(options)};
+    CHECK(color.size() == 37 * 21 * 3);
+    CHECK(color[(5 * 37 + 3) * 3 + 0] == float(3 / 37.0));
+    CHECK(color[(5 * 37 + 3) * 3 + 1] == float(5 / 21.0));
+    SUBCASE("PFM") {
+      std::stringstream stream;
+      image.writePFM(stream, options);
+      std::string bytes{stream.str()};
+      std::string header{"PF\n37 21\n-1\n"};
+      CHECK(bytes.substr(0, header.size()) == header);
+      CHECK(bytes.size() == header.size() + color.size() * sizeof(float));
+      // The scanlines are stored from bottom to top.
+      std::vector<float> values(color.size());
+      std::memcpy(values.data(), bytes.data() + header.size(), values.size() * sizeof(float));
+      for (int y = 0; y < 21; y++)
+        for (int x = 0; x < 37 * 3; x++) CHECK_MESSAGE(values[size_t(20 - y) * 37 * 3 + x] == color[size_t(y) * 37 * 3 + x], "x = ", x, ", y = ", y);
+    }
+    SUBCASE("OpenEXR") {
+      std::stringstream stream;
+      image.writeEXR(stream, options);
+      std::string bytes{stream.str()};
+      size_t position{0};
+      auto read = [&]<typename Value>(Value value) {
+        std::memcpy(&value, bytes.data() + position, sizeof(Value));
+        position += sizeof(Value);
+        return value;
+      };
+      auto readString = [&] {
+        std::string value{bytes.data() + position};
+        position += value.size() + 1;
+        return value;
+      };
+      CHECK(read(int32_t()) == 20000630);
+      CHECK(read(int32_t()) == 2);
+      std::set<std::string> names;
+      for (std::string name{readString()}; !name.empty(); name = readString()) {
+        names.insert(name);
+        readString();
+        position += size_t(read(int32_t()));
+      }
+      CHECK(names.contains("channels"));
+      CHECK(names.contains("compression"));
+      CHECK(names.contains("dataWindow"));
+      CHECK(names.contains("displayWindow"));
+      CHECK(names.contains("lineOrder"));
+      CHECK(names.contains("pixelAspectRatio"));
+      CHECK(names.contains("screenWindowCenter"));
+      CHECK(names.contains("screenWindowWidth"));
+      // There are 2 chunks of 16 scanlines. Decode the first one.
+      uint64_t offset{read(uint64_t())};
+      read(uint64_t());
+      CHECK(offset == position);
+      CHECK(read(int32_t()) == 0);
+      size_t chunkSize{size_t(read(int32_t()))};
+      mi::miniz::Bytes predictedBytes{mi::miniz::inflate(bytes.data() + position, chunkSize)};
+      REQUIRE(predictedBytes.size() == 16 * 37 * 3 * sizeof(float));
+      const size_t numBytes{predictedBytes.size()};
+      for (size_t i = 1; i < numBytes; i++) predictedBytes[i] = std::byte(uint8_t(int(predictedBytes[i - 1]) + int(predictedBytes[i]) - 128));
+      std::vector<std::byte> rawBytes(numBytes);
+      for (size_t i = 0; i < numBytes; i++) rawBytes[i] = predictedBytes[(i & 1) ? (numBytes + 1) / 2 + i / 2 : i / 2];
+      // Every scanline holds the channels in alphabetical order, so blue, green, then red.
+      for (int y = 0; y < 16; y++) {
+        for (int c = 0; c < 3; c++) {
+          for (int x = 0; x < 37; x++) {
+            float value;
+            std::memcpy(&value, &rawBytes[((size_t(y) * 3 + size_t(c)) * 37 + size_t(x)) * sizeof(float)], sizeof(float));
+            CHECK_MESSAGE(value == color[(size_t(y) * 37 + size_t(x)) * 3 + size_t(2 - c)], "x = ", x, ", y = ", y, ", c = ", c);
+          }
+        }
+      }
+    }
+  }
+  SUBCASE("Write rejects empty images") {
+    for (mi::Vector2i size : {mi::Vector2i(0, 5), mi::Vector2i(5, 0), mi::Vector2i(0, 0)}) {
+      mi::render::SpectrumImage image;
+      image.resize(3, size);
+      std::stringstream stream;
+      CHECK_THROWS_AS(image.writePFM(stream, {}), std::invalid_argument);
+      CHECK_THROWS_AS(image.writeEXR(stream, {.compress = true}), std::invalid_argument);
+      CHECK_THROWS_AS(image.writeEXR(stream, {.compress = false}), std::invalid_argument);
+    }
+  }
+}
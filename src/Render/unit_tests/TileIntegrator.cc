@@ -0,0 +1,49 @@
+#include "Microcosm/Render/TileIntegrator"
+#include "testing.h"
+#include <omp.h>
+
+TEST_CASE("TileIntegrator") {
+  SUBCASE("Image does not depend on the number of threads") {
+    // Deliberately use an image size that is not a multiple of the tile size.
+    mi::render::TileIntegrator integrator{{.printProgress = false, .seed = 7, .tileSize = {4, 5}, .numSamplesPerPixel = 3}};
+    auto pixelSampler = [](mi::render::TileIntegrator::Worker &worker, mi::Vector2d pixelCoordinate) {
+      double sampleU{worker.random.generate1()};
+      return mi::render::Spectrum{std::sin(pixelCoordinate[0] * pixelCoordinate[1] + sampleU), sampleU};
+    };
+    auto render = [&](int numThreads) {
+      int maxThreads{omp_get_max_threads()};
+      omp_set_num_threads(numThreads);
+      mi::render::SpectrumImage image;
+      image.resize(2, {21, 13});
+      integrator(image, pixelSampler);
+      omp_set_num_threads(maxThreads);
+      return image;
+    };
+    auto imageA{render(1)};
+    auto imageB{render(4)};
+    for (int y = 0; y < 13; y++) {
+      for (int x = 0; x < 21; x++) {
+        auto valuesA{imageA.extract({x, y})};
+        auto valuesB{imageB.extract({x, y})};
+        INFO("x = ", x, ", y = ", y);
+        CHECK(imageA.pixelReference({x, y}).num == 3);
+        CHECK(imageB.pixelReference({x, y}).num == 3);
+        CHECK(mi::allTrue(valuesA == valuesB));
+      }
+    }
+  }
+  SUBCASE("Exceptions propagate out of the parallel region") {
+    mi::render::TileIntegrator integrator{{.printProgress = false, .tileSize = {4, 4}, .numSamplesPerPixel = 1}};
+    mi::render::SpectrumImage image;
+    image.resize(2, {16, 16});
+    CHECK_THROWS_AS(integrator(image, [](auto &, mi::Vector2d) { return mi::render::Spectrum{1.0}; }), std::logic_error);
+    CHECK_THROWS_AS(
+      integrator(
+        image,
+        [](auto &, mi::Vector2d pixelCoordinate) {
+          if (pixelCoordinate[0] > 10) throw std::runtime_error("Failure");
+          return mi::render::Spectrum{1.0, 2.0};
+        }),
+      std::runtime_error);
+  }
+}
@@ -0,0 +1,241 @@
+#include "Microcosm/Render/More/Shape/TriangleMesh"
+#include "testing.h"
+
+TEST_CASE("TriangleMesh") {
+  auto prng = PRNG();
+  auto randomRay = [&] {
+    mi::Vector3d origin{mi::randomize<mi::Vector3d>(prng) * 6.0 - 3.0};
+    mi::Vector3d target{mi::randomize<mi::Vector3d>(prng) * 2.0 - 1.0};
+    return mi::Ray3d(origin, normalize(target - origin));
+  };
+  // Unindexed triangles over a pool of shared points, so that initialize() has vertices to merge. The normal of
+  // every vertex is the direction to its position, which covers every octant for the octahedral encoding.
+  auto randomSoup = [&] {
+    std::vector<mi::Vector3f> points;
+    for (int k = 0; k < 100; k++) points.push_back(mi::Vector3f(mi::randomize<mi::Vector3d>(prng) * 2.0 - 1.0));
+    mi::render::TriangleMesh mesh;
+    mesh.positions.resize(3 * 300);
+    mesh.normals.emplace(mi::with_shape, 3 * 300);
+    for (size_t v = 0; v < 3 * 300; v++) {
+      mi::Vector3f point{points[size_t(mi::randomize<double>(prng) * points.size()) % points.size()]};
+      mesh.positions.row(v).assign(point);
+      mesh.normals->row(v).assign(normalize(point));
+    }
+    return mesh;
+  };
+  // The triangles as stored in the mesh, in the order of the primitive indexes.
+  auto trianglesOf = [](const mi::render::TriangleMesh &mesh) {
+    std::vector<mi::render::Triangle> triangles;
+    for (size_t i = 0; i < mesh.numTris(); i++) {
+      triangles.emplace_back(
+        mesh.vertexPosition(mesh.indexes[3 * i + 0]), //
+        mesh.vertexPosition(mesh.indexes[3 * i + 1]), //
+        mesh.vertexPosition(mesh.indexes[3 * i + 2]));
+    }
+    return triangles;
+  };
+  auto checkAgainstBruteForce = [&](const mi::render::TriangleMesh &mesh) {
+    std::vector<mi::render::Triangle> triangles{trianglesOf(mesh)};
+    int numHits{0};
+    std::vector<mi::Ray3d> rays;
+    std::vector<std::optional<double>> params;
+    for (int k = 0; k < 500; k++) {
+      mi::Ray3d ray{randomRay()};
+      mi::render::Manifold manifoldA;
+      mi::render::Manifold manifoldB;
+      std::optional<double> paramA{mesh.intersect(ray, manifoldA)};
+      std::optional<double> paramB{};
+      rays.push_back(ray);
+      params.push_back(paramA);
+      for (const auto &triangle : triangles) {
+        if (auto param = triangle.intersect(ray, manifoldB)) ray.maxParam = *param, paramB = param;
+      }
+      CHECK(paramA.has_value() == paramB.has_value());
+      if (paramA && paramB) {
+        numHits++;
+        CHECK(*paramA == Approx(*paramB));
+        // Note: The random triangles interpenetrate, so the two may pick different triangles right at an intersection.
+        CHECK(mi::distance(manifoldA.point, manifoldB.point) < 1e-4);
+        REQUIRE(manifoldA.primitiveIndex < triangles.size());
+        mi::render::Manifold manifoldC;
+        auto paramC{triangles[manifoldA.primitiveIndex].intersect(rays.back(), manifoldC)};
+        CHECK(paramC.has_value());
+        if (paramC) CHECK(*paramC == Approx(*paramA));
+      }
+    }
+    CHECK(numHits > 50);
+    std::vector<mi::render::Manifold> manifolds(rays.size());
+    std::vector<std::optional<double>> batchParams{mesh.intersect(rays, manifolds)};
+    for (size_t k = 0; k < rays.size(); k++) {
+      CHECK(batchParams[k].has_value() == params[k].has_value());
+      if (batchParams[k] && params[k]) CHECK(*batchParams[k] == Approx(*params[k]));
+    }
+    for (int k = 0; k < 200; k++) {
+      mi::Vector3d referencePoint{mi::randomize<mi::Vector3d>(prng) * 6.0 - 3.0};
+      mi::render::Manifold manifoldA;
+      mi::render::Manifold manifoldB;
+      std::optional<double> distA{mesh.nearestTo(referencePoint, manifoldA)};
+      std::optional<double> distB{};
+      for (const auto &triangle : triangles) {
+        if (auto dist = triangle.nearestTo(referencePoint, manifoldB)) distB = dist;
+      }
+      CHECK(distA.has_value());
+      CHECK(distB.has_value());
+      if (distA && distB) {
+        CHECK(*distA == Approx(*distB));
+        CHECK(*distA == Approx(mi::distance(referencePoint, manifoldA.point)));
+        CHECK(manifoldA.nearestDistance == *distA);
+      }
+    }
+  };
+  SUBCASE("Unindexed input matches brute force") {
+    mi::render::TriangleMesh mesh{randomSoup()};
+    mesh.initialize();
+    CHECK(mesh.numTris() == 300);
+    CHECK(mesh.numVerts() <= 100);
+    checkAgainstBruteForce(mesh);
+  }
+  SUBCASE("Mesh input matches brute force") {
+    mi::geometry::Mesh sphere{mi::geometry::Mesh::makeSphere(24, 12, 0.8f)};
+    mi::render::TriangleMesh mesh{sphere};
+    CHECK(mesh.hasTexcoords());
+    CHECK(mesh.hasNormals());
+    CHECK(mesh.numVerts() < 3 * mesh.numTris());
+    checkAgainstBruteForce(mesh);
+  }
+  SUBCASE("Quantized input matches brute force") {
+    mi::render::TriangleMesh mesh;
+    mesh.quantizeNormals = true;
+    mesh.quantizeTexcoords = true;
+    mesh.initialize(mi::geometry::Mesh::makeSphere(24, 12, 0.8f));
+    CHECK(!mesh.normals);
+    CHECK(!mesh.texcoords);
+    CHECK(mesh.hasNormals());
+    CHECK(mesh.hasTexcoords());
+    checkAgainstBruteForce(mesh);
+  }
+  SUBCASE("Spatial splits input matches brute force") {
+    mi::render::TriangleMesh mesh{randomSoup()};
+    mesh.buildOptions.spatialSplits = true;
+    mesh.initialize();
+    checkAgainstBruteForce(mesh);
+  }
+  SUBCASE("Texcoord tangents match LU solve") {
+    // Every 10th triangle has degenerate texture coordinates, for which the tangents must fall back to zero.
+    mi::render::TriangleMesh mesh{randomSoup()};
+    mesh.texcoords.emplace(mi::with_shape, mesh.positions.rows());
+    for (size_t v = 0; v < mesh.positions.rows(); v++) mesh.texcoords->row(v).assign(mi::Vector2f(mi::randomize<mi::Vector2d>(prng)));
+    for (size_t v = 0; v < mesh.positions.rows(); v += 30) mesh.texcoords->row(v + 1).assign(mesh.texcoords->row(v));
+    mesh.initialize();
+    REQUIRE(mesh.texcoordTangents);
+    int numDegenerate{0};
+    for (size_t i = 0; i < mesh.numTris(); i++) {
+      mi::Vector2d texcoord0{mesh.vertexTexcoord(mesh.indexes[3 * i + 0])};
+      mi::Vector3d point0{mesh.vertexPosition(mesh.indexes[3 * i + 0])};
+      mi::Matrix<double, 2, 2> deltaUVs;
+      mi::Matrix<double, 2, 3> edges;
+      for (size_t k = 0; k < 2; k++) {
+        deltaUVs.row(k).assign(mesh.vertexTexcoord(mesh.indexes[3 * i + k + 1]) - texcoord0);
+        edges.row(k).assign(mesh.vertexPosition(mesh.indexes[3 * i + k + 1]) - point0);
+      }
+      mi::Vector3d tangent0{mesh.texcoordTangents->row(2 * i + 0)};
+      mi::Vector3d tangent1{mesh.texcoordTangents->row(2 * i + 1)};
+      mi::Matrix<double, 2, 3> expected;
+      try {
+        expected = mi::DecompLU(deltaUVs).solve(edges);
+      } catch (const std::runtime_error &) {
+        numDegenerate++;
+        CHECK(mi::allTrue(tangent0 == 0));
+        CHECK(mi::allTrue(tangent1 == 0));
+        continue;
+      }
+      CHECK_MESSAGE(mi::length(tangent0 - mi::Vector3d(expected.row(0))) < 1e-6 * (1 + mi::length(tangent0)), "tangent0 = ", tangent0, ", expected = ", mi::Vector3d(expected.row(0)));
+      CHECK_MESSAGE(mi::length(tangent1 - mi::Vector3d(expected.row(1))) < 1e-6 * (1 + mi::length(tangent1)), "tangent1 = ", tangent1, ", expected = ", mi::Vector3d(expected.row(1)));
+    }
+    CHECK(numDegenerate >= 30);
+  }
+  SUBCASE("Octahedral encoding round trip") {
+    // Note: The vertices are reordered, but every normal is a function of the position, so no bookkeeping is necessary.
+    mi::render::TriangleMesh soup{randomSoup()};
+    mi::render::TriangleMesh mesh;
+    mesh.positions.resize(soup.positions.rows() + 6);
+    mesh.normals.emplace(mi::with_shape, soup.positions.rows() + 6);
+    for (size_t v = 0; v < soup.positions.rows(); v++) {
+      mesh.positions.row(v).assign(soup.positions.row(v));
+      mesh.normals->row(v).assign(soup.normals->row(v));
+    }
+    for (size_t axis = 0; axis < 3; axis++) {
+      for (int sign : {+1, -1}) {
+        size_t v{soup.positions.rows() + (sign > 0 ? 0 : 3) + axis};
+        mi::Vector3f point{};
+        point[axis] = 2.0f * sign;
+        mesh.positions.row(v).assign(point);
+        mesh.normals->row(v).assign(normalize(point));
+      }
+    }
+    mesh.quantizeNormals = true;
+    mesh.initialize();
+    REQUIRE(mesh.quantizedNormals.size() == mesh.numVerts());
+    for (uint32_t v = 0; v < mesh.numVerts(); v++) {
+      mi::Vector3d normal{normalize(mesh.vertexPosition(v))};
+      mi::Vector3d decoded{mesh.vertexNormal(v)};
+      CHECK(mi::length(decoded) == Approx(1.0));
+      // About 0.005 degrees, as documented.
+      CHECK_MESSAGE(std::acos(std::min(mi::dot(normal, decoded), 1.0)) < 1e-4, "normal = ", normal, ", decoded = ", decoded);
+    }
+  }
+  SUBCASE("Triangle nearest point, regressions") {
+    mi::render::Triangle triangle{mi::Vector3d(1, 1, 5), mi::Vector3d(3, 1, 5), mi::Vector3d(1, 3, 5)};
+    mi::render::Manifold manifold;
+    // The projection must be onto the plane through the triangle, not the plane through the origin.
+    auto dist{triangle.nearestTo(mi::Vector3d(1.5, 1.5, 7), manifold)};
+    REQUIRE(dist.has_value());
+    CHECK(*dist == Approx(2.0));
+    CHECK(mi::allTrue(mi::abs(manifold.point - mi::Vector3d(1.5, 1.5, 5)) < 1e-9));
+    CHECK(manifold.nearestDistance == *dist);
+    // The edge and vertex fallbacks are always farther away than the plane, but must still succeed.
+    manifold = {};
+    dist = triangle.nearestTo(mi::Vector3d(0, 1.5, 6), manifold);
+    REQUIRE(dist.has_value());
+    CHECK(*dist == Approx(std::sqrt(2.0)));
+    CHECK(mi::allTrue(mi::abs(manifold.point - mi::Vector3d(1, 1.5, 5)) < 1e-9));
+    manifold = {};
+    dist = triangle.nearestTo(mi::Vector3d(0, 0, 5), manifold);
+    REQUIRE(dist.has_value());
+    CHECK(*dist == Approx(std::sqrt(2.0)));
+    CHECK(mi::allTrue(mi::abs(manifold.point - mi::Vector3d(1, 1, 5)) < 1e-9));
+    // A nearer result so far must still win.
+    manifold.nearestDistance = 1;
+    CHECK(!triangle.nearestTo(mi::Vector3d(0, 0, 5), manifold));
+    CHECK(manifold.nearestDistance == 1);
+  }
+  SUBCASE("TriangleMesh nearest point, regressions") {
+    // Two stacked triangles under the reference point. The mesh must return the nearer one, which requires comparing
+    // against the best distance so far, and not against the distance each triangle writes back into the manifold.
+    mi::render::TriangleMesh mesh;
+    mesh.positions.resize(6);
+    for (size_t i = 0; i < 2; i++) {
+      float z{i == 0 ? 0.0f : 1.0f};
+      mesh.positions.row(3 * i + 0).assign(mi::Vector3f(0, 0, z));
+      mesh.positions.row(3 * i + 1).assign(mi::Vector3f(1, 0, z));
+      mesh.positions.row(3 * i + 2).assign(mi::Vector3f(0, 1, z));
+    }
+    mesh.initialize();
+    mi::render::Manifold manifold;
+    auto dist{mesh.nearestTo(mi::Vector3d(0.25, 0.25, 3), manifold)};
+    REQUIRE(dist.has_value());
+    CHECK(*dist == Approx(2.0));
+    CHECK(manifold.point[2] == Approx(1.0));
+    CHECK(manifold.nearestDistance == *dist);
+    CHECK(mesh.vertexPosition(mesh.indexes[3 * manifold.primitiveIndex])[2] == 1.0);
+    manifold = {};
+    dist = mesh.nearestTo(mi::Vector3d(0.25, 0.25, -3), manifold);
+    REQUIRE(dist.has_value());
+    CHECK(*dist == Approx(3.0));
+    CHECK(manifold.point[2] == Approx(0.0));
+    manifold = {};
+    manifold.nearestDistance = 1;
+    CHECK(!mesh.nearestTo(mi::Vector3d(0.25, 0.25, 3), manifold));
+    CHECK(manifold.nearestDistance == 1);
+  }
+}
@@ -0,0 +1,118 @@
+#include "Microcosm/Render/VCM"
+#include "testing.h"
+
+namespace {
+
+/// A Lambertian scattering function for surfaces facing up the Z-axis, with the projected cosine included.
+struct LambertianBSDF {
+  using bsdf_tag = std::true_type;
+  double albedo{0.8};
+  mi::render::BidirPDF scatter(mi::Vector3d omegaO, mi::Vector3d omegaI, mi::render::Spectrum &f) const {
+    f += albedo * mi::render::OneOverPi * std::abs(omegaI[2]);
+    return {std::abs(omegaI[2]) * mi::render::OneOverPi, std::abs(omegaO[2]) * mi::render::OneOverPi};
+  }
+  mi::render::BidirPDF scatterSample(mi::render::Random &, mi::Vector3d, mi::Vector3d &, mi::render::Spectrum &) const { return {}; }
+};
+
+} // namespace
+
+TEST_CASE("VCMIntegrator") {
+  // A point light with unit intensity at height one above a Lambertian plane, which an orthographic camera looks down
+  // on over the square from -1 to 1. The pixel sampler only forms the merges, and ignores their weights, which is plain
+  // progressive photon mapping, so the image must converge to the reflected radiance albedo / pi * h / d^3.
+  constexpr double albedo{0.8};
+  constexpr double height{1.0};
+  constexpr int imageSize{8};
+  const mi::Vector3d lightPosition{0, 0, height};
+  auto surfaceVertex = [](mi::render::Path::Kind kind, mi::Vector3d point) {
+    mi::render::Manifold manifold;
+    manifold.point = point;
+    manifold.correct.normal = manifold.shading.normal = mi::Vector3d(0, 0, 1);
+    mi::render::Path::Vertex vertex{point};
+    vertex.manifold = manifold;
+    vertex.material.scattering = mi::render::Scattering(LambertianBSDF{albedo});
+    vertex.runtime.kind = kind;
+    return vertex;
+  };
+  auto lightPathSampler = [&](mi::render::Random &random, mi::render::Path &path) {
+    // Emit uniformly into the lower hemisphere, so the ratio is the intensity over the direction density.
+    path.clear();
+    mi::Vector3d omega{mi::render::uniformHemisphereSample(random.generate2())};
+    omega[2] = -omega[2];
+    path.push(mi::render::Path::Vertex{lightPosition});
+    mi::render::Path::Vertex &lightVertex{path.back()};
+    lightVertex.runtime.kind = mi::render::Path::Kind::Light;
+    lightVertex.runtime.ratio = mi::render::Spectrum{1.0};
+    lightVertex.runtime.pathPDF.forward = 1;
+    lightVertex.runtime.scatteringPDF.forward = mi::render::uniformHemispherePDF();
+    path.push(surfaceVertex(mi::render::Path::Kind::Light, lightPosition + omega * (height / -omega[2])));
+    mi::render::Path::Vertex &vertex{path.back()};
+    vertex.runtime.ratio = mi::render::Spectrum{1.0 / mi::render::uniformHemispherePDF()};
+    vertex.runtime.omegaO = -omega;
+    vertex.recalculateForwardPathPDF(path[0]);
+  };
+  auto pixelSampler = [&](mi::render::TileIntegrator::Worker &worker, mi::Vector2d pixelCoordinate, const mi::render::VertexMerger &merger) {
+    mi::Vector3d point{pixelCoordinate[0] / imageSize * 2 - 1, pixelCoordinate[1] / imageSize * 2 - 1, 0};
+    worker.path.clear();
+    worker.path.push(mi::render::Path::Vertex{point + mi::Vector3d(0, 0, 1)});
+    mi::render::Path::Vertex &cameraVertex{worker.path.back()};
+    cameraVertex.runtime.kind = mi::render::Path::Kind::Camera;
+    cameraVertex.runtime.ratio = mi::render::Spectrum{1.0};
+    cameraVertex.runtime.pathPDF.forward = 1;
+    cameraVertex.runtime.scatteringPDF.forward = 1;
+    worker.path.push(surfaceVertex(mi::render::Path::Kind::Camera, point));
+    mi::render::Path::Vertex &vertex{worker.path.back()};
+    vertex.runtime.ratio = mi::render::Spectrum{1.0};
+    vertex.runtime.omegaO = mi::Vector3d(0, 0, 1);
+    vertex.recalculateForwardPathPDF(worker.path[0]);
+    mi::render::Spectrum result{0.0};
+    merger.merge(worker.random, mi::render::PathView(worker.path.begin(), worker.path.end()), [&](auto, auto, double, const mi::render::Spectrum &L) { result += L; });
+    return result;
+  };
+  // The reference, averaged over the area of every pixel.
+  auto reference = [&](int x, int y) {
+    double sum{0};
+    for (int j = 0; j < 8; j++) {
+      for (int i = 0; i < 8; i++) {
+        mi::Vector3d point{(x + (i + 0.5) / 8) / imageSize * 2 - 1, (y + (j + 0.5) / 8) / imageSize * 2 - 1, 0};
+        sum += albedo * mi::render::OneOverPi * height / std::pow(mi::distance(point, lightPosition), 3);
+      }
+    }
+    return sum / 64;
+  };
+  auto render = [&](size_t numIterations) {
+    mi::render::VCMIntegrator integrator{{.printProgress = false, .seed = 7, .tileSize = {4, 4}, .numIterations = numIterations, .numPathsFromLight = 20000, .initialRadius = 0.1}};
+    mi::render::SpectrumImage image;
+    image.resize(1, {imageSize, imageSize});
+    integrator(image, mi::render::PathConnector{}, lightPathSampler, pixelSampler);
+    return image;
+  };
+  SUBCASE("Image is finite and converges") {
+    auto rmsRelativeError = [&](mi::render::SpectrumImage &image) {
+      double sum{0};
+      for (int y = 0; y < imageSize; y++) {
+        for (int x = 0; x < imageSize; x++) {
+          double value{image.extract({x, y}, /*divideOutNum=*/false, /*divideOutWeight=*/true)[0]};
+          INFO("x = ", x, ", y = ", y);
+          CHECK(std::isfinite(value));
+          CHECK(value >= 0);
+          double error{value / reference(x, y) - 1};
+          sum += error * error;
+        }
+      }
+      return std::sqrt(sum / (imageSize * imageSize));
+    };
+    auto imageA{render(2)};
+    auto imageB{render(32)};
+    double errorA{rmsRelativeError(imageA)};
+    double errorB{rmsRelativeError(imageB)};
+    CHECK(errorB < errorA);
+    CHECK(errorB < 0.06);
+  }
+  SUBCASE("Exceptions propagate out of the parallel region") {
+    mi::render::VCMIntegrator integrator{{.printProgress = false, .numIterations = 1}};
+    mi::render::SpectrumImage image;
+    image.resize(1, {imageSize, imageSize});
+    CHECK_THROWS_AS(integrator(image, mi::render::PathConnector{}, [](auto &, auto &) { throw std::runtime_error("Light path sampler failed"); }, pixelSampler), std::runtime_error);
+  }
+}
@@ -0,0 +1,28 @@
+#include "Microcosm/Render/common"
+#include "testing.h"
+#include <random>
+
+TEST_CASE("Random") {
+  SUBCASE("Buffering does not change the sample sequence") {
+    auto checkSequence = [](auto generator) {
+      auto generatorExpected{generator};
+      mi::render::Random random{generator};
+      CHECK(random.isBuffered());
+      // Mix the request sizes, so that many requests span the boundaries between blocks.
+      for (int k = 0; k < 10 * int(mi::render::Random::BufferSize); k++) {
+        auto check = [&](auto sampleU) {
+          for (size_t i = 0; i < sampleU.size(); i++) CHECK_MESSAGE(sampleU[i] == mi::randomize<double>(generatorExpected), "k = ", k, ", i = ", i);
+        };
+        switch (k % 4) {
+        case 0: check(mi::Vector<double, 1>(random.generate1())); break;
+        case 1: check(random.generate2()); break;
+        case 2: check(random.generate3()); break;
+        case 3: check(random.generate4()); break;
+        }
+      }
+    };
+    checkSequence(mi::Pcg32(PRNG()()));
+    checkSequence(mi::Pcg32(7, 13));
+    checkSequence(std::mt19937(7));
+  }
+}
@@ -11,3 +11,12 @@ TEST_CASE("random") {
   SUBCASE("Pcg32") { TestPcg<mi::Pcg32>(); }
   SUBCASE("Pcg64") { TestPcg<mi::Pcg64>(); }
 }
+
+TEST_CASE("Pcg32Lanes") {
+  mi::Pcg32 prng = PRNG();
+  mi::Pcg32Lanes<8> lanes(prng);
+  uint32_t results[64]{};
+  lanes(&results[0], 64);
+  for (size_t i = 0; i < 64; i++) CHECK_MESSAGE(results[i] == prng(), "i = ", i);
+  CHECK(lanes.scalar(prng) == prng);
+}
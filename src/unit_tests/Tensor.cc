@@ -86,6 +86,32 @@ TEST_CASE("Tensor") {
     CHECK(mi::dot(vectorU, vectorV) == mi::trace(mi::outer(vectorU, vectorV)));
   }
 
+  SUBCASE("Small storage") {
+    mi::Vector<double, mi::Dynamic, 8> vectorU{mi::with_shape, 4};
+    mi::Vector<double, mi::Dynamic, 8> vectorV = {1, 2, 3, 4};
+    CHECK(mi::allTrue(vectorU == 0.0));
+    auto isInline = [](const auto &vector) {
+      auto *bytes{reinterpret_cast<const std::byte *>(vector.data())};
+      return reinterpret_cast<const std::byte *>(&vector) <= bytes && bytes < reinterpret_cast<const std::byte *>(&vector + 1);
+    };
+    CHECK(isInline(vectorU));
+    CHECK(isInline(vectorV));
+    vectorU = vectorV * 2 + 1;
+    CHECK(mi::allTrue(vectorU == mi::Vector<double, mi::Dynamic, 8>{3, 5, 7, 9}));
+    mi::Vector<double, mi::Dynamic, 8> vectorW{std::move(vectorU)};
+    CHECK(vectorW.size() == 4);
+    CHECK(vectorW[3] == 9);
+    CHECK(isInline(vectorW));
+    vectorW.resize(8);
+    CHECK(isInline(vectorW));
+    vectorW.resize(12); // Spill to the heap.
+    CHECK(!isInline(vectorW));
+    CHECK(vectorW[3] == 9);
+    CHECK(vectorW[11] == 0);
+    mi::Vector4d vectorX{vectorV};
+    CHECK(mi::allTrue(vectorX == mi::Vector4d(1, 2, 3, 4)));
+  }
+
   SUBCASE("Geometric") {
     mi::Vector3f vectorU = {+1, +2, +3};
     mi::Vector3f vectorV = {+2, +0, +0};
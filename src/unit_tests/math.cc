@@ -32,6 +32,24 @@ TEST_CASE("math") {
     SUBCASE("Logistic") { ContinuousDistributionChecks(mi::distributions::Logistic(-2.7, 0.4)); }
     SUBCASE("HyperbolicSecant") { ContinuousDistributionChecks(mi::distributions::HyperbolicSecant(+5.1, 3.2)); }
     SUBCASE("Exponential") { ContinuousDistributionChecks(mi::distributions::Exponential(4.2)); }
+    SUBCASE("PiecewiseConstant") {
+      mi::distributions::PiecewiseConstant distr({1.0, 3.0, 0.0, 2.5, 0.7}, -1.5, 4);
+      ContinuousDistributionChecks(distr);
+      CHECK(distr.integral() == Approx(7.2 * 5.5 / 5));
+      CHECK(distr.distributionPDF(1.0) == 0.0); // Empty bin.
+    }
+    SUBCASE("Alias") {
+      std::vector<double> weights{1.0, 3.0, 0.0, 2.5, 0.7, 4.1};
+      mi::distributions::Alias distr(weights);
+      mi::distributions::Discrete reference(weights);
+      std::vector<double> counts(weights.size(), 0.0);
+      mi::Pcg32 prng = PRNG();
+      for (double sampleU : mi::randomize<double>(prng, 1 << 16)) counts[distr.distributionSample(sampleU)] += 1.0 / (1 << 16);
+      for (int i = 0; i < distr.size(); i++) {
+        CHECK(distr.distributionPMF(i) == Approx(reference.distributionPMF(i)));
+        CHECK(counts[i] == Approx(distr.distributionPMF(i)).epsilon(0.05));
+      }
+    }
   }
   SUBCASE("Interpolation") {
     CHECK(mi::lerp(0.5, 4, 8) == 6);